@@ -0,0 +1,646 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "chunk.hh"
+#include "compiler.hh"
+#include "isolate.hh"
+#include "native.hh"
+#include "object.hh"
+#include "scheduler.hh"
+#include "scanner.hh"
+#include "tokenizer.hh"
+#include "vm.hh"
+
+// Compiled workloads stay small and get their weight from repetition; scanning is measured
+// on megabytes of source.
+#define MAX_LITERALS 250
+#define SCAN_SOURCE_BYTES (4 * 1024 * 1024)
+#define DEFAULT_SAMPLES 15
+#define DEFAULT_WARMUP 3
+#define DEFAULT_THRESHOLD 0.10
+#define TARGET_SAMPLE_NS 10000000.0
+#define STARTUP_SCRIPT "1 + 2\n"
+#define SCHEDULE_LONG_SCRIPTS 4
+#define SCHEDULE_ROUNDS_PER_SAMPLE 10
+#define FORMAT_VALUES 1000
+#define PIPELINE_MESSAGES 1024
+#define PIPELINE_DISTINCT 64
+#define PIPELINE_MESSAGE_BYTES 4096
+#define REPL_LINE "\"con\" + \"cat\" == \"concat\" == !(1 + 2 * 3 < 4)\n"
+
+extern char **environ;
+
+struct Workload {
+    const char *name;
+    std::string source;
+};
+
+struct Result {
+    std::string name;
+    double nanoseconds;
+    double bytesPerSecond;
+    uint64_t iterations;
+};
+
+struct Options {
+    const char *filter = nullptr;
+    const char *outPath = nullptr;
+    const char *baselinePath = nullptr;
+    int samples = DEFAULT_SAMPLES;
+    int warmup = DEFAULT_WARMUP;
+    double threshold = DEFAULT_THRESHOLD;
+};
+
+static std::string numericSource() {
+    std::string source = "1";
+    const char *operators[] = {" + ", " * ", " - ", " / "};
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        source += operators[i % 4];
+        source += std::to_string(i % 97 + 1) + "." + std::to_string(i % 10);
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+// The same shape as numericSource() with integer literals, which stay integers throughout.
+static std::string integerSource() {
+    std::string source = "1";
+    const char *operators[] = {" + ", " * ", " - ", " + "};
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        source += operators[i % 4];
+        source += std::to_string(i % 97 + 1);
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+// Full-precision literals, which take the parser past its exact small-number fast path.
+static std::string decimalSource() {
+    std::string source = "3.141592653589793";
+    const char *operators[] = {" + ", " * ", " - ", " / "};
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        char literal[32];
+        snprintf(literal, sizeof(literal), "%.17g", (i % 97 + 1) * 1.0471975511965976);
+        source += operators[i % 4];
+        source += literal;
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+// Calls to a typed native, which takes its doubles straight off the stack, and the same calls
+// to one taking boxed values.
+static std::string callSource(const char *function) {
+    std::string source = function;
+    source += "(0.5, 1.5)";
+    for (int i = 1; i < MAX_LITERALS / 2; i++) {
+        char arguments[32];
+        snprintf(arguments, sizeof(arguments), "(%d.5, %d.25)", i % 97 + 1, i % 13);
+        source += " + ";
+        source += function;
+        source += arguments;
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+static bool boxedMax(int, const Value *args, Value *result) {
+    if (!args[0].isNumber() || !args[1].isNumber()) return false;
+    *result = Value(std::max(args[0].asNumber(), args[1].asNumber()));
+    return true;
+}
+
+// A rule over inputs the host bound as globals, reading each of them many times.
+static std::string globalSource() {
+    const char *names[] = {"price", "quantity", "discount", "tax"};
+    const char *operators[] = {" + ", " * ", " - ", " / "};
+    std::string source = "var total = price * quantity;\ntotal";
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        source += operators[i % 4];
+        source += names[i * 7 % 4];
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+// The same rule with its intermediate results computed once into block locals.
+static std::string localSource() {
+    const char *names[] = {"gross", "net", "levy", "unit"};
+    const char *operators[] = {" + ", " * ", " - ", " / "};
+    std::string source = "{\nvar gross = price * quantity;\nvar net = gross - discount;\n"
+                         "var levy = net * tax;\nvar unit = net / quantity;\ngross";
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        source += operators[i % 4];
+        source += names[i * 7 % 4];
+        if (i % 8 == 0) source += "\n";
+    }
+    source += "\n}";
+    return source;
+}
+
+// Whole-array arithmetic, comparisons and reductions: one instruction per operation, however
+// long the arrays are.
+static std::string arraySource() {
+    return "{\nvar x = range(4096) * 0.25;\nvar y = 1024 - x;\nvar mask = x < y;\n"
+           "sum(x * y) + dot(x, mask) + minOf(x - y) + maxOf(x / (y + 1)) + sum(-x * mask)\n}";
+}
+
+#define MAP_BENCH_KEYS 64
+
+// Keyed lookups: a map of string keys filled once, then read many times over.
+static std::string mapSource() {
+    std::string source = "{\nvar prices = map();\n";
+    for (int i = 0; i < MAP_BENCH_KEYS; i++) {
+        char entry[64];
+        snprintf(entry, sizeof(entry), "set(prices, \"item%d\", %d);\n", i, i * 3 + 1);
+        source += entry;
+    }
+    source += "get(prices, \"item0\")";
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        char lookup[64];
+        snprintf(lookup, sizeof(lookup), " + get(prices, \"item%d\")", i * 7 % MAP_BENCH_KEYS);
+        source += lookup;
+        if (i % 8 == 0) source += "\n";
+    }
+    source += "\n}";
+    return source;
+}
+
+static std::string comparisonSource() {
+    std::string source = "1 < 2";
+    for (int i = 2; i < MAX_LITERALS / 2; i++) {
+        source += i % 2 == 0 ? " == " : " != ";
+        source += '(';
+        source += std::to_string(i);
+        source += i % 3 == 0 ? " > " : " <= ";
+        source += std::to_string(i * 7 % 13);
+        source += ')';
+        if (i % 8 == 0) source += "\n";
+    }
+    return source;
+}
+
+static std::string concatSource() {
+    std::string source = "\"a\"";
+    for (int i = 1; i < MAX_LITERALS; i++) {
+        source += " + \"";
+        source += (char) ('a' + i % 26);
+        source += "\"";
+        if (i % 16 == 0) source += "\n";
+    }
+    return source;
+}
+
+static std::string hugeLiteralSource() {
+    std::string source = "\"";
+    for (size_t i = 0; i < SCAN_SOURCE_BYTES / 4; i++) {
+        source += (char) ('a' + i % 26);
+        if (i % 100 == 99) source += '\n';
+    }
+    source += "\"";
+    return source;
+}
+
+// Scanning throughput is measured on megabytes of source made by repeating a workload.
+static std::string repeatToSize(const std::string &source) {
+    std::string repeated;
+    repeated.reserve(SCAN_SOURCE_BYTES + source.size());
+    while (repeated.size() < SCAN_SOURCE_BYTES) {
+        repeated += source;
+        repeated += "\n";
+    }
+    return repeated;
+}
+
+static std::vector<Workload> workloads() {
+    return {
+            {"numeric",      numericSource()},
+            {"integer",      integerSource()},
+            {"decimal",      decimalSource()},
+            {"call-typed",   callSource("max")},
+            {"call-boxed",   callSource("boxedMax")},
+            {"globals",      globalSource()},
+            {"locals",       localSource()},
+            {"arrays",       arraySource()},
+            {"maps",         mapSource()},
+            {"comparison",   comparisonSource()},
+            {"concat",       concatSource()},
+            {"huge-literal", hugeLiteralSource()},
+    };
+}
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Picks an iteration count filling roughly TARGET_SAMPLE_NS, then reports the median sample.
+// `reset` runs untimed before every sample; without a GC it is what keeps the heap bounded.
+static Result measure(const Options &options, const std::string &name, size_t bytes,
+                      const std::function<void()> &body, const std::function<void()> &reset) {
+    reset();
+    uint64_t calibration = 0;
+    uint64_t start = now();
+    do {
+        body();
+        calibration++;
+    } while ((double) (now() - start) < TARGET_SAMPLE_NS / 10);
+    auto iterations = (uint64_t) std::max(1.0, (double) calibration * TARGET_SAMPLE_NS / (double) (now() - start));
+
+    for (int i = 0; i < options.warmup; i++) {
+        reset();
+        for (uint64_t j = 0; j < iterations; j++) body();
+    }
+
+    std::vector<double> samples;
+    for (int i = 0; i < options.samples; i++) {
+        reset();
+        start = now();
+        for (uint64_t j = 0; j < iterations; j++) body();
+        samples.push_back((double) (now() - start) / (double) iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+    double median = samples[samples.size() / 2];
+    return {name, median, bytes > 0 ? (double) bytes * 1e9 / median : 0, iterations};
+}
+
+static void scanAll(const std::string &source) {
+    initScanner(source.data(), source.size());
+    while (scanToken().type != TokenType::TOKEN_EOF) {}
+}
+
+static void compileOnce(const std::string &source, Chunk *chunk) {
+    if (!compile(source.data(), source.size(), chunk)) {
+        fprintf(stderr, "Benchmark source failed to compile.\n");
+        exit(1);
+    }
+}
+
+static void compileOnce(const std::string &source) {
+    Chunk chunk;
+    initChunk(&chunk);
+    compileOnce(source, &chunk);
+    freeChunk(&chunk);
+}
+
+static void initBenchVM() {
+    if (!initVM() || !defineNative("boxedMax", 2, boxedMax)) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    defineGlobal("price", Value(19.99));
+    defineGlobal("quantity", Value((int64_t) 3));
+    defineGlobal("discount", Value(0.15));
+    defineGlobal("tax", Value(1.2));
+}
+
+static void resetVM() {
+    freeVM();
+    initBenchVM();
+}
+
+static void benchWorkload(const Options &options, const Workload &workload, std::vector<Result> &results) {
+    std::string scanSource = repeatToSize(workload.source);
+    results.push_back(measure(options, std::string("scan/") + workload.name, scanSource.size(),
+                              [&] { scanAll(scanSource); }, [] {}));
+
+    // Only measured where the source gets split, i.e. on machines with more than one core.
+    TokenBuffer buffer;
+    if (tokenizeParallel(scanSource.data(), scanSource.size(), &buffer)) {
+        freeTokenBuffer(&buffer);
+        results.push_back(measure(options, std::string("tokenize/") + workload.name, scanSource.size(), [&] {
+            tokenizeParallel(scanSource.data(), scanSource.size(), &buffer);
+            freeTokenBuffer(&buffer);
+        }, [] {}));
+    }
+
+    results.push_back(measure(options, std::string("compile/") + workload.name, workload.source.size(),
+                              [&] { compileOnce(workload.source); }, resetVM));
+
+    // Resetting the VM frees the chunk's string constants, so the chunk is recompiled with it.
+    Chunk chunk;
+    initChunk(&chunk);
+    results.push_back(measure(options, std::string("run/") + workload.name, 0, [&] {
+        interpretChunk(&chunk);
+    }, [&] {
+        freeChunk(&chunk);
+        resetVM();
+        compileOnce(workload.source, &chunk);
+    }));
+    freeChunk(&chunk);
+    resetVM();
+}
+
+// Launches the interpreter on `scriptPath` and waits for it, so a sample covers process
+// startup, static initialization, compiling, running and teardown.
+static void runClox(const char *scriptPath, const char *option = nullptr) {
+    char *const argv[] = {const_cast<char *>(CLOX_BINARY),
+                          const_cast<char *>(option != nullptr ? option : scriptPath),
+                          option != nullptr ? const_cast<char *>(scriptPath) : nullptr, nullptr};
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, CLOX_BINARY, nullptr, nullptr, argv, environ) != 0 ||
+        waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Could not run \"%s\".\n", CLOX_BINARY);
+        exit(1);
+    }
+}
+
+static void writeScript(char *scriptPath, const std::string &source) {
+    int fd = mkstemp(scriptPath);
+    if (fd < 0 || write(fd, source.data(), source.size()) < 0) {
+        fprintf(stderr, "Could not write the startup script.\n");
+        exit(74);
+    }
+    close(fd);
+}
+
+// startup/cold and startup/warm run a script holding a megabyte of string literal without and
+// with a snapshot; the first warm run writes the image the others load.
+static void benchStartup(const Options &options, std::vector<Result> &results) {
+    char scriptPath[] = "/tmp/clox_bench_XXXXXX";
+    writeScript(scriptPath, STARTUP_SCRIPT);
+    results.push_back(measure(options, "startup/trivial", 0, [&] { runClox(scriptPath); }, [] {}));
+    unlink(scriptPath);
+
+    char stringsPath[] = "/tmp/clox_bench_XXXXXX";
+    writeScript(stringsPath, hugeLiteralSource() + " == \"\"");
+    char snapshotOption[64];
+    snprintf(snapshotOption, sizeof(snapshotOption), "--snapshot=%s.img", stringsPath);
+    results.push_back(measure(options, "startup/cold", 0, [&] { runClox(stringsPath); }, [] {}));
+    results.push_back(measure(options, "startup/warm", 0, [&] { runClox(stringsPath, snapshotOption); }, [] {}));
+    unlink(stringsPath);
+    unlink(snapshotOption + strlen("--snapshot="));
+}
+
+// Printing results: doubles of every magnitude, most of them needing all 17 digits.
+static void benchFormat(const Options &options, std::vector<Result> &results) {
+    std::vector<Value> values;
+    uint64_t state = 0x9E3779B97F4A7C15u;
+    for (int i = 0; i < FORMAT_VALUES; i++) {
+        state = state * 6364136223846793005u + 1442695040888963407u;
+        double magnitude = (double) (state >> 11) * 0x1p-53;
+        values.emplace_back(i % 4 == 0 ? (double) (i - FORMAT_VALUES / 2) / 8 : magnitude * (i % 2 == 0 ? 1e-9 : 1e12));
+    }
+    char buffer[64];
+    size_t bytes = 0;
+    for (const Value &value: values) bytes += value.format(buffer, sizeof(buffer));
+    results.push_back(measure(options, "format/doubles", bytes, [&] {
+        for (const Value &value: values) value.format(buffer, sizeof(buffer));
+    }, [] {}));
+}
+
+// Messages through the same four concatenations, done by one isolate and by four stages in a
+// row. At most half a channel of messages is in flight, so sending never waits for receiving.
+static void benchPipeline(const Options &options, std::vector<Result> &results) {
+    std::vector<Value> messages;
+    for (int i = 0; i < PIPELINE_DISTINCT; i++) {
+        std::string text(PIPELINE_MESSAGE_BYTES, (char) ('a' + i % 26));
+        text += std::to_string(i);
+        messages.emplace_back(copyString(text.data(), (int) text.size()));
+    }
+    const PipelineStage combined[] = {{"+ \"w\" + \"x\" + \"y\" + \"z\"", 1}};
+    const PipelineStage staged[] = {{"+ \"w\"", 1}, {"+ \"x\"", 1}, {"+ \"y\"", 1}, {"+ \"z\"", 1}};
+    const struct {
+        const char *name;
+        const PipelineStage *stages;
+        uint32_t stageCount;
+    } modes[] = {
+            {"pipeline/one-isolate",  combined, 1},
+            {"pipeline/four-stages", staged,   4},
+    };
+    for (const auto &mode: modes) {
+        Pipeline pipeline;
+        if (!initPipeline(&pipeline, mode.stages, mode.stageCount, PIPELINE_DEFAULT_CAPACITY)) exit(1);
+        results.push_back(measure(options, mode.name, (size_t) PIPELINE_MESSAGES * PIPELINE_MESSAGE_BYTES, [&] {
+            Value result;
+            for (int i = 0; i < PIPELINE_MESSAGES; i++) {
+                sendMessage(pipelineInput(&pipeline), messages[i % PIPELINE_DISTINCT]);
+                if (i >= PIPELINE_DEFAULT_CAPACITY / 2) receiveMessage(pipelineOutput(&pipeline), &result);
+            }
+            for (int i = 0; i < std::min(PIPELINE_MESSAGES, PIPELINE_DEFAULT_CAPACITY / 2); i++) {
+                receiveMessage(pipelineOutput(&pipeline), &result);
+            }
+        }, [] {}));
+        freePipeline(&pipeline);
+    }
+}
+
+// A script that runs long for its size: every step copies a 64 KiB string.
+static std::string longRunningSource() {
+    std::string source = "\"" + std::string(64 * 1024, 'x') + "\"";
+    for (int i = 0; i < 100; i++) source += " + \"y\"";
+    return source;
+}
+
+static void ignoreResult(void *, InterpretResult, Value, size_t) {}
+
+static void recordFinish(void *context, InterpretResult, Value, size_t) {
+    ((std::atomic<uint64_t> *) context)->store(now());
+}
+
+// Latency of a short script submitted behind long-running ones on one scheduler thread, run to
+// completion and time-sliced. Reported as the median over rounds rather than through measure(),
+// which would also time the long scripts.
+static void benchSchedule(const Options &options, std::vector<Result> &results) {
+    const std::string longSource = longRunningSource();
+    const size_t length = strlen(REPL_LINE);
+    const struct {
+        const char *name;
+        uint32_t quantum;
+    } modes[] = {
+            {"schedule/run-to-completion", UINT32_MAX},
+            {"schedule/time-sliced",       SCHEDULER_DEFAULT_QUANTUM},
+    };
+    for (const auto &mode: modes) {
+        Scheduler scheduler;
+        initScheduler(&scheduler, 1, mode.quantum);
+        std::vector<double> latencies;
+        int rounds = (options.warmup + options.samples) * SCHEDULE_ROUNDS_PER_SAMPLE;
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < SCHEDULE_LONG_SCRIPTS; i++) {
+                submitScript(&scheduler, longSource.data(), longSource.size(), 0, ignoreResult, nullptr);
+            }
+            std::atomic<uint64_t> finished{0};
+            uint64_t start = now();
+            submitScript(&scheduler, REPL_LINE, length, 0, recordFinish, &finished);
+            drainScheduler(&scheduler);
+            if (round >= options.warmup * SCHEDULE_ROUNDS_PER_SAMPLE) {
+                latencies.push_back((double) (finished - start));
+            }
+        }
+        freeScheduler(&scheduler);
+        std::sort(latencies.begin(), latencies.end());
+        results.push_back({mode.name, latencies[latencies.size() / 2], 0, latencies.size()});
+    }
+}
+
+// One REPL line, either compiled into a fresh chunk like a script or appended to a session.
+static void benchRepl(const Options &options, std::vector<Result> &results) {
+    const size_t length = strlen(REPL_LINE);
+    results.push_back(measure(options, "repl/fresh", length, [&] { interpret(REPL_LINE, length); }, resetVM));
+
+    Session session;
+    initSession(&session);
+    results.push_back(measure(options, "repl/session", length, [&] {
+        interpretSession(&session, REPL_LINE, length);
+    }, [&] {
+        freeSession(&session);
+        resetVM();
+        initSession(&session);
+    }));
+    freeSession(&session);
+    resetVM();
+}
+
+static void writeResults(FILE *out, const std::vector<Result> &results) {
+    fprintf(out, "{\"results\":[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        fprintf(out, "  {\"name\":\"%s\",\"ns\":%.1f,\"bytes_per_second\":%.0f,\"iterations\":%llu}%s\n",
+                result.name.c_str(), result.nanoseconds, result.bytesPerSecond,
+                (unsigned long long) result.iterations, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+// Reads back the format written by writeResults(); only name and ns are needed.
+static std::vector<Result> readBaseline(const char *path) {
+    std::vector<Result> baseline;
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not open baseline \"%s\".\n", path);
+        exit(74);
+    }
+    std::string text;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, read);
+    fclose(file);
+
+    size_t position = 0;
+    while ((position = text.find("\"name\":\"", position)) != std::string::npos) {
+        position += 8;
+        size_t end = text.find('"', position);
+        size_t ns = text.find("\"ns\":", end);
+        if (end == std::string::npos || ns == std::string::npos) break;
+        baseline.push_back({text.substr(position, end - position), strtod(text.c_str() + ns + 5, nullptr), 0, 0});
+        position = ns;
+    }
+    return baseline;
+}
+
+// Workloads missing from the baseline are listed rather than skipped, so a stale baseline shows.
+static int compareBaseline(const Options &options, const std::vector<Result> &results) {
+    std::vector<Result> baseline = readBaseline(options.baselinePath);
+    int regressions = 0;
+    for (const Result &current: results) {
+        auto old = std::find_if(baseline.begin(), baseline.end(),
+                                [&](const Result &entry) { return entry.name == current.name; });
+        if (old == baseline.end()) {
+            fprintf(stderr, "%-24s %12s -> %12.1f ns  NOT IN BASELINE\n", current.name.c_str(), "",
+                    current.nanoseconds);
+            continue;
+        }
+        double change = (current.nanoseconds - old->nanoseconds) / old->nanoseconds;
+        bool regressed = change > options.threshold;
+        if (regressed) regressions++;
+        fprintf(stderr, "%-24s %12.1f -> %12.1f ns %+7.1f%%%s\n", current.name.c_str(),
+                old->nanoseconds, current.nanoseconds, change * 100, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox_bench [--filter=substring] [--samples=n] [--warmup=n]\n"
+                    "                  [--out=results.json] [--baseline=baseline.json] [--threshold=0.10]\n");
+    exit(64);
+}
+
+static Options parseOptions(int argc, const char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--filter=", 9) == 0) {
+            options.filter = arg + 9;
+        } else if (strncmp(arg, "--samples=", 10) == 0) {
+            options.samples = std::max(1, atoi(arg + 10));
+        } else if (strncmp(arg, "--warmup=", 9) == 0) {
+            options.warmup = std::max(0, atoi(arg + 9));
+        } else if (strncmp(arg, "--out=", 6) == 0) {
+            options.outPath = arg + 6;
+        } else if (strncmp(arg, "--baseline=", 11) == 0) {
+            options.baselinePath = arg + 11;
+        } else if (strncmp(arg, "--threshold=", 12) == 0) {
+            options.threshold = strtod(arg + 12, nullptr);
+        } else {
+            usage();
+        }
+    }
+    return options;
+}
+
+int main(int argc, const char *argv[]) {
+    Options options = parseOptions(argc, argv);
+
+    // The interpreter prints disassembly and results to stdout; keep it out of the measurements.
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    initBenchVM();
+    std::vector<Result> results;
+    for (const Workload &workload: workloads()) {
+        if (options.filter != nullptr && strstr(workload.name, options.filter) == nullptr) continue;
+        benchWorkload(options, workload, results);
+        fprintf(stderr, "%s done\n", workload.name);
+    }
+    if (options.filter == nullptr || strstr("repl", options.filter) != nullptr) {
+        benchRepl(options, results);
+        fprintf(stderr, "repl done\n");
+    }
+    if (options.filter == nullptr || strstr("format", options.filter) != nullptr) {
+        benchFormat(options, results);
+        fprintf(stderr, "format done\n");
+    }
+    if (options.filter == nullptr || strstr("pipeline", options.filter) != nullptr) {
+        benchPipeline(options, results);
+        fprintf(stderr, "pipeline done\n");
+    }
+    if (options.filter == nullptr || strstr("schedule", options.filter) != nullptr) {
+        benchSchedule(options, results);
+        fprintf(stderr, "schedule done\n");
+    }
+    if (options.filter == nullptr || strstr("startup", options.filter) != nullptr) {
+        benchStartup(options, results);
+        fprintf(stderr, "startup done\n");
+    }
+    freeVM();
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    FILE *out = stdout;
+    if (options.outPath != nullptr && (out = fopen(options.outPath, "w")) == nullptr) {
+        fprintf(stderr, "Could not write \"%s\".\n", options.outPath);
+        return 74;
+    }
+    writeResults(out, results);
+    if (out != stdout) fclose(out);
+
+    if (options.baselinePath != nullptr && compareBaseline(options, results) > 0) return 1;
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "server.hh"
+
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_REQUESTS 10000
+#define DEFAULT_SOURCE "\"con\" + \"cat\" == \"concat\" == !(1 + 2 * 3 < 4)\n"
+
+struct Options {
+    const char *socketPath = nullptr;
+    std::string source = DEFAULT_SOURCE;
+    int connections = DEFAULT_CONNECTIONS;
+    int requests = DEFAULT_REQUESTS;
+    bool precompiled = false;
+};
+
+// What one connection saw; latencies are per request, in nanoseconds.
+struct ClientStats {
+    std::vector<uint64_t> latencies;
+    int errors;
+};
+
+static void usage() {
+    fprintf(stderr, "Usage: clox_loadgen --socket=path [--connections=n] [--requests=n per connection]\n"
+                    "                    [--source=text | --script=path] [--precompiled]\n");
+    exit(64);
+}
+
+static std::string readScript(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    std::string text;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, read);
+    fclose(file);
+    return text;
+}
+
+static Options parseOptions(int argc, const char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--socket=", 9) == 0) {
+            options.socketPath = arg + 9;
+        } else if (strncmp(arg, "--connections=", 14) == 0) {
+            options.connections = std::max(1, atoi(arg + 14));
+        } else if (strncmp(arg, "--requests=", 11) == 0) {
+            options.requests = std::max(1, atoi(arg + 11));
+        } else if (strncmp(arg, "--source=", 9) == 0) {
+            options.source = arg + 9;
+        } else if (strncmp(arg, "--script=", 9) == 0) {
+            options.source = readScript(arg + 9);
+        } else if (strcmp(arg, "--precompiled") == 0) {
+            options.precompiled = true;
+        } else {
+            usage();
+        }
+    }
+    if (options.socketPath == nullptr) usage();
+    return options;
+}
+
+static int connectTo(const char *socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) < 0) {
+        fprintf(stderr, "Could not connect to \"%s\".\n", socketPath);
+        exit(74);
+    }
+    return fd;
+}
+
+// Sends one request and waits for its response; returns false if the connection failed.
+static bool roundTrip(int fd, RequestKind kind, const std::string &payload, uint8_t *status, std::string *response) {
+    return writeFrame(fd, (uint8_t) kind, payload.data(), (uint32_t) payload.size()) &&
+           readFrame(fd, status, response, UINT32_MAX);
+}
+
+static std::string registerScript(const Options &options) {
+    int fd = connectTo(options.socketPath);
+    uint8_t status;
+    std::string id;
+    if (!roundTrip(fd, RequestKind::REGISTER, options.source, &status, &id) ||
+        status != (uint8_t) ResponseStatus::OK) {
+        fprintf(stderr, "Could not register the script.\n");
+        exit(65);
+    }
+    close(fd);
+    return id;
+}
+
+static void runClient(const Options &options, RequestKind kind, const std::string &payload, ClientStats *stats) {
+    int fd = connectTo(options.socketPath);
+    stats->latencies.reserve(options.requests);
+    uint8_t status;
+    std::string response;
+    for (int i = 0; i < options.requests; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (!roundTrip(fd, kind, payload, &status, &response)) {
+            stats->errors += options.requests - i;
+            break;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        stats->latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        if (status != (uint8_t) ResponseStatus::OK) stats->errors++;
+    }
+    close(fd);
+}
+
+static double percentile(const std::vector<uint64_t> &sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index = std::min(sorted.size() - 1, (size_t) (fraction * (double) sorted.size()));
+    return (double) sorted[index];
+}
+
+int main(int argc, const char *argv[]) {
+    Options options = parseOptions(argc, argv);
+    RequestKind kind = RequestKind::EVAL;
+    std::string payload = options.source;
+    if (options.precompiled) {
+        kind = RequestKind::RUN;
+        payload = registerScript(options);
+    }
+
+    std::vector<ClientStats> stats(options.connections);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.connections; i++) {
+        clients.emplace_back(runClient, std::cref(options), kind, std::cref(payload), &stats[i]);
+    }
+    for (std::thread &client: clients) client.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint64_t> latencies;
+    int errors = 0;
+    for (const ClientStats &client: stats) {
+        latencies.insert(latencies.end(), client.latencies.begin(), client.latencies.end());
+        errors += client.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{\"mode\":\"%s\",\"connections\":%d,\"requests\":%zu,\"errors\":%d,\"seconds\":%.3f,"
+           "\"requests_per_second\":%.0f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+           options.precompiled ? "run" : "eval", options.connections, latencies.size(), errors, seconds,
+           (double) latencies.size() / seconds, percentile(latencies, 0.50) / 1000,
+           percentile(latencies, 0.99) / 1000, latencies.empty() ? 0 : (double) latencies.back() / 1000);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef CLOX_ARRAY_H
+#define CLOX_ARRAY_H
+
+#include <cstdint>
+
+// What one instruction does to every element of an array. Comparisons give 1 for true and 0
+// for false.
+enum struct ArrayOp : uint8_t {
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    EQUAL,
+    GREATER,
+    LESS,
+    GREATER_EQUAL,
+    LESS_EQUAL,
+    NEGATE,
+};
+
+// The kernels take element storage of an ObjArray, aligned to ARRAY_ALIGNMENT, and run as
+// AVX2 or SSE2 where the build targets it, one element at a time otherwise.
+
+// out[i] = a[i] op b[i]. A side marked as a scalar is one number applied to every element.
+void applyArrayOp(ArrayOp op, const double *a, bool scalarA, const double *b, bool scalarB, double *out,
+                  int32_t count);
+
+// NEGATE: out[i] = -a[i].
+void applyArrayUnary(ArrayOp op, const double *a, double *out, int32_t count);
+
+// Summed in vector lanes, so the rounding can differ from adding left to right.
+double arraySum(const double *values, int32_t count);
+
+double arrayDot(const double *a, const double *b, int32_t count);
+
+// NaN elements are skipped; an empty array gives infinity and minus infinity respectively.
+double arrayMin(const double *values, int32_t count);
+
+double arrayMax(const double *values, int32_t count);
+
+#endif //CLOX_ARRAY_H
@@ -0,0 +1,54 @@
+#ifndef CLOX_CHANNEL_H
+#define CLOX_CHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include "value.hh"
+
+// Keeps the positions of senders and receivers on separate cache lines.
+#define CHANNEL_ALIGNMENT 64
+
+struct ChannelCell;
+
+// A bounded lock-free queue of values between threads (Vyukov's array queue): any number of
+// senders and receivers claim cells with one compare-and-swap and block only when it is full
+// or empty. A string or array is copied into the receiver's heap before its cell is given back,
+// so once drainChannel() returns the sender no longer needs the heap it sent from.
+struct Channel {
+    ChannelCell *cells;
+    uint64_t mask;
+    alignas(CHANNEL_ALIGNMENT) std::atomic<uint64_t> sendPosition;
+    alignas(CHANNEL_ALIGNMENT) std::atomic<uint64_t> receivePosition;
+    // Senders that have not called closeChannel() yet.
+    alignas(CHANNEL_ALIGNMENT) std::atomic<uint32_t> producers;
+};
+
+// `capacity` is rounded up to a power of two.
+void initChannel(Channel *channel, uint32_t capacity, uint32_t producers);
+
+void freeChannel(Channel *channel);
+
+enum struct ReceiveResult : uint8_t {
+    OK,
+    // The message was dropped because it did not fit in the receiver's heap.
+    OUT_OF_MEMORY,
+    // Every producer has closed the channel and everything they sent has been received.
+    CLOSED,
+};
+
+// Blocks while the channel is full. Maps and natives cannot be sent, as only their owner's
+// VM can read them.
+void sendMessage(Channel *channel, Value value);
+
+// Blocks while the channel is empty. Needs a VM on the calling thread to copy strings and
+// arrays into.
+ReceiveResult receiveMessage(Channel *channel, Value *value);
+
+// Blocks until every message sent so far has been received, after which the heaps they were
+// sent from can be freed.
+void drainChannel(Channel *channel);
+
+// Called by each producer when it is done sending.
+void closeChannel(Channel *channel);
+
+#endif //CLOX_CHANNEL_H
@@ -15,6 +15,8 @@ enum struct OpCode : uint8_t {
     MULTIPLY,
     DIVIDE,
     CONSTANT,
+    // Operand is a 24-bit little-endian constant index, for pools past 256 entries.
+    CONSTANT_LONG,
     NIL,
     TRUE,
     FALSE,
@@ -22,8 +24,27 @@ enum struct OpCode : uint8_t {
     EQUAL,
     GREATER,
     LESS,
+    GREATER_EQUAL,
+    LESS_EQUAL,
+    // Operand is the argument count; the callee sits below the arguments.
+    CALL,
+    POP,
+    // Operand is a 16-bit little-endian index into VM::globals.
+    DEFINE_GLOBAL,
+    GET_GLOBAL,
+    SET_GLOBAL,
+    // Operand is a slot in VM::stack, counted from its bottom.
+    GET_LOCAL,
+    SET_LOCAL,
+    // Operand is the number of values to drop.
+    POPN,
 };
 
+// Keep in sync with the last OpCode; sizes the per-opcode tables.
+constexpr size_t OPCODE_COUNT = static_cast<size_t>(OpCode::POPN) + 1;
+
+#define MAX_CONSTANTS (1 << 24)
+
 struct Chunk {
     int32_t count;
     int32_t capacity;
@@ -36,8 +57,10 @@ void initChunk(Chunk *chunk);
 
 void freeChunk(Chunk *chunk);
 
-void writeChunk(Chunk *chunk, uint8_t byte, int32_t line);
+// Returns false, writing nothing, when the chunk cannot grow.
+bool writeChunk(Chunk *chunk, uint8_t byte, int32_t line);
 
-int addConstant(Chunk *chunk, Value value);
+// Returns the constant's index, or -1 when the constant pool cannot grow.
+int32_t addConstant(Chunk *chunk, Value value);
 
 #endif //CLOX_CHUNK_H
@@ -7,6 +7,12 @@
 
 #include "chunk.hh"
 
-bool compile(const char* source, Chunk* chunk);
+#include <cstddef>
+
+bool compile(const char *source, size_t length, Chunk *chunk);
+
+// Compiles a pipeline stage: operators applied to a value the chunk finds on the stack, so
+// "* 2 + 1" doubles its input and adds one. An empty stage returns its input unchanged.
+bool compileStage(const char *source, size_t length, Chunk *chunk);
 
 #endif //CLOX_COMPILER_H
@@ -5,7 +5,8 @@
 #ifndef CLOX_CONFIG_H
 #define CLOX_CONFIG_H
 
+#if !defined(NDEBUG)
 #define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+#endif
 
 #endif //CLOX_CONFIG_H
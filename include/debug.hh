@@ -7,8 +7,11 @@
 
 #include "chunk.hh"
 
-void disassembleChunk(Chunk *chunk, const char *name);
+// Disassembles the code from `start` on, which is where the latest input begins in a session.
+void disassembleChunk(Chunk *chunk, const char *name, int32_t start);
 
 int32_t disassembleInstruction(Chunk *chunk, int32_t offset);
 
+const char *opcodeName(OpCode opcode);
+
 #endif //CLOX_DEBUG_H
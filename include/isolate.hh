@@ -0,0 +1,51 @@
+#ifndef CLOX_ISOLATE_H
+#define CLOX_ISOLATE_H
+
+#include <atomic>
+#include <cstdint>
+#include "channel.hh"
+
+// Messages a channel between two stages holds before its sender blocks.
+#define PIPELINE_DEFAULT_CAPACITY 1024
+// An isolate whose heap grows past this waits for the next stage to take everything it sent,
+// then starts over with a fresh VM.
+#define ISOLATE_HEAP_LIMIT (64 * 1024 * 1024)
+
+struct PipelineStage {
+    // Compiled with compileStage(): the operators applied to every message, e.g. "+ \"!\"".
+    const char *source;
+    // Isolates sharing the stage's messages, at least one; with more, results leave out of order.
+    uint32_t isolates;
+};
+
+struct Isolate;
+
+// Stages running in parallel, each isolate a thread with its own VM, joined by channels.
+// Every message is copied into the heap of the isolate that receives it, and the results into
+// the embedder's VM, so a stream costs one copy per stage. Maps and natives cannot be passed on.
+struct Pipeline {
+    Isolate *isolates;
+    uint32_t isolateCount;
+    // stageCount + 1 channels: the input, one between every two stages and the output.
+    Channel *channels;
+    uint32_t stageCount;
+    // Messages dropped because a stage failed on them; the error went to stderr.
+    std::atomic<uint64_t> errors;
+};
+
+// Returns false, with nothing left running, when a stage does not compile or an isolate runs
+// out of memory starting up.
+bool initPipeline(Pipeline *pipeline, const PipelineStage *stages, uint32_t stageCount, uint32_t capacity);
+
+// The embedder is the only producer of the input and closes it when done. It has to keep the
+// strings it sent alive until drainChannel() on the input returns; a stage may be waiting to
+// hand over its results before it starts over, so read the output empty first.
+Channel *pipelineInput(Pipeline *pipeline);
+
+Channel *pipelineOutput(Pipeline *pipeline);
+
+// Closes the input unless that was done already, discards the results not yet received and
+// stops the isolates, releasing their heaps.
+void freePipeline(Pipeline *pipeline);
+
+#endif //CLOX_ISOLATE_H
@@ -0,0 +1,45 @@
+#ifndef CLOX_MAP_H
+#define CLOX_MAP_H
+
+#include <cstdint>
+#include "value.hh"
+
+// Keys compare like `==`, so 1 and 1.0 are the same key and strings match by content, which
+// interning makes a pointer comparison.
+struct MapEntry {
+    Value key;
+    Value value;
+};
+
+// SwissTable-style open addressing. Every slot has a control byte: empty, or the low seven bits
+// of the key's hash. A probe compares a whole group of control bytes at once and only looks
+// at the entries whose byte matches. Deletion shifts later entries back instead of leaving
+// tombstones, so probes never get longer after keys are removed.
+struct Map {
+    // `capacity` control bytes, then copies of the first group's, so a group can be read at any slot.
+    uint8_t *control;
+    MapEntry *entries;
+    int32_t count;
+    int32_t capacity;
+    // Slab size class of the storage holding both arrays.
+    uint8_t sizeClass;
+};
+
+struct ObjMap {
+    struct Obj obj;
+    Map map;
+};
+
+void initMap(Map *map);
+
+void freeMap(Map *map);
+
+bool mapGet(const Map *map, Value key, Value *value);
+
+// Returns false, leaving the map as it was, when it has to grow and cannot.
+bool mapSet(Map *map, Value key, Value value);
+
+// Returns whether the key was there.
+bool mapDelete(Map *map, Value key);
+
+#endif //CLOX_MAP_H
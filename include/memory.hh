@@ -6,20 +6,97 @@
 #define CLOX_MEMORY_H
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
+#define GROW_ARRAY(type, pointer, oldCount, newCount, category) \
     (type*)reallocate(pointer, sizeof(type) * (oldCount), \
-    sizeof(type) * (newCount))
+    sizeof(type) * (newCount), category)
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(type, pointer, oldCount, category) \
+    reallocate(pointer, sizeof(type) * (oldCount), 0, category)
 
-#define ALLOCATE(type, count) \
-    (type*)reallocate(nullptr, 0, sizeof(type) * (count))
+#define ALLOCATE(type, count, category) \
+    (type*)reallocate(nullptr, 0, sizeof(type) * (count), category)
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+// Slabs are carved out of 2 MiB chunks so the kernel can back them with huge pages.
+#define SLAB_CHUNK_SIZE (2 * 1024 * 1024)
+#define SIZE_CLASS_LARGE UINT8_MAX
+
+// Allocation sizes are bucketed by powers of two: bucket i holds sizes in (2^(i-1), 2^i].
+#define MEMORY_HISTOGRAM_BUCKETS 24
+
+enum struct MemoryCategory : uint8_t {
+    CODE,
+    LINES,
+    CONSTANTS,
+    STRINGS,
+    OBJECTS,
+    TABLES,
+    OTHER,
+    COUNT,
+};
+
+enum struct MemoryStatsFormat {
+    TEXT,
+    JSON,
+};
+
+struct MemoryCategoryStats {
+    size_t liveBytes;
+    size_t peakBytes;
+    size_t allocatedBytes;
+    size_t allocations;
+    size_t reallocations;
+    size_t frees;
+    size_t histogram[MEMORY_HISTOGRAM_BUCKETS];
+};
+
+struct MemoryStats {
+    size_t liveBytes;
+    size_t peakBytes;
+    MemoryCategoryStats categories[static_cast<size_t>(MemoryCategory::COUNT)];
+};
+
+// Bytes held by one VM. While a quota is active every allocation on the thread is charged to it,
+// and growth that would take `usedBytes` past a non-zero `limitBytes` is refused.
+struct MemoryQuota {
+    size_t limitBytes;
+    size_t usedBytes;
+    size_t peakBytes;
+};
+
+// Makes `quota` the one charged by the calling thread's allocations; nullptr charges none.
+void setMemoryQuota(MemoryQuota *quota);
+
+MemoryQuota *memoryQuota();
+
+// Returns nullptr, leaving `pointer` as it was, when growing it would exceed the active quota
+// or the system is out of memory. Shrinking and freeing always succeed.
+void *reallocate(void *pointer, size_t oldSize, size_t newSize, MemoryCategory category);
+
+// Takes over `size` bytes that another thread allocated with reallocate() and handed to this
+// one, so they are charged to this thread's quota and statistics and can be freed here. The
+// bytes are charged even past the limit; returns false when they went over it.
+bool adoptAllocation(size_t size, MemoryCategory category);
+
+// Returns a slot of at least `size` bytes from the calling thread's slabs, or nullptr like
+// reallocate(). Sizes above the largest class fall back to reallocate() and report SIZE_CLASS_LARGE.
+void *allocateSlot(size_t size, MemoryCategory category, uint8_t *sizeClass);
+
+void freeSlot(void *slot, size_t size, uint8_t sizeClass, MemoryCategory category);
+
+// Releases every chunk and large slot owned by the calling thread, invalidating all of its slots.
+void freeSlabs();
+
+const char *memoryCategoryName(MemoryCategory category);
+
+// Statistics of the calling thread's allocations.
+const MemoryStats &memoryStats();
+
+void printMemoryStats(FILE *out, MemoryStatsFormat format);
 
 #endif //CLOX_MEMORY_H
@@ -0,0 +1,30 @@
+#ifndef CLOX_NATIVE_H
+#define CLOX_NATIVE_H
+
+#include <cstdint>
+#include "object.hh"
+#include "value.hh"
+
+// Arguments a call can pass; the count is a one-byte operand.
+#define MAX_ARGUMENTS UINT8_MAX
+
+// Binds a host function to the global `name` in this thread's VM, until the next initVM().
+// Returns false when out of memory.
+bool defineNative(const char *name, double (*function)());
+
+bool defineNative(const char *name, double (*function)(double));
+
+bool defineNative(const char *name, double (*function)(double, double));
+
+bool defineNative(const char *name, uint8_t arity, NativeFn function);
+
+// For a native that fails: records why, in a message that outlives the call such as a string
+// literal, and returns false, so the native can `return nativeError("...");`. The runtime error
+// then shows the message instead of a generic one.
+bool nativeError(const char *message);
+
+// clock, sqrt, floor, abs, pow, min and max; for arrays array, range, length, at, sum, dot,
+// equalEach, minOf and maxOf; for maps map, get, set, has, remove and length. initVM() defines them.
+bool defineStandardNatives();
+
+#endif //CLOX_NATIVE_H
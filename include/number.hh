@@ -0,0 +1,17 @@
+#ifndef CLOX_NUMBER_H
+#define CLOX_NUMBER_H
+
+#include <cstddef>
+
+// Longest text formatDouble() writes, e.g. "-2.2250738585072014e-308", plus the terminator.
+#define DOUBLE_BUFFER_SIZE 32
+
+// Converts a number literal as the scanner accepts it, digits with an optional fraction, to
+// the nearest double. Independent of the C locale.
+double parseDecimal(const char *start, const char *end);
+
+// Writes the shortest decimal that reads back as `value` and returns its length. Magnitudes
+// from 1e-6 up to 1e21 are written out positionally, others in scientific notation.
+int formatDouble(double value, char *buffer);
+
+#endif //CLOX_NUMBER_H
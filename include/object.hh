@@ -5,22 +5,100 @@
 #ifndef CLOX_OBJECT_H
 #define CLOX_OBJECT_H
 
-enum struct ObjectType {
+#include <cstdint>
+
+enum struct ObjectType : uint8_t {
     STRING,
+    NATIVE,
+    ARRAY,
+    MAP,
 };
 
+// Single-word header: the slab size class lets an object be freed without a size lookup.
 struct Obj {
     ObjectType type;
+    uint8_t sizeClass;
+    bool isMarked;
+    uint8_t reserved;
 };
 
+static_assert(sizeof(Obj) == sizeof(uint32_t));
+
+// Strings are interned in vm.strings, so equal strings are the same object.
 struct ObjString {
     struct Obj obj;
     int length;
-    char *chars;
+    uint32_t hash;
+    char chars[];
 };
 
-struct ObjString *takeString(char *chars, int length);
+class Value;
+
+// Natives that take any values report a failed call by returning false.
+typedef bool (*NativeFn)(int argCount, const Value *args, Value *result);
+
+// The typed signatures take and return doubles; a call passes doubles straight off the stack.
+enum struct NativeSignature : uint8_t {
+    VALUES,
+    NUMBER_0,
+    NUMBER_1,
+    NUMBER_2,
+};
+
+struct ObjNative {
+    struct Obj obj;
+    NativeSignature signature;
+    uint8_t arity;
+    ObjString *name;
+    union {
+        NativeFn values;
+        double (*number0)();
+        double (*number1)(double);
+        double (*number2)(double, double);
+    } function;
+};
+
+// Arrays stay below 2 GiB of elements.
+#define ARRAY_MAX_LENGTH (1 << 28)
+// Element storage starts on a cache line, so the kernels can use aligned vector loads.
+#define ARRAY_ALIGNMENT 64
+
+// Packed doubles, operated on a whole array per instruction.
+struct ObjArray {
+    struct Obj obj;
+    int32_t count;
+    double *values;
+};
+
+// Declared with its table in map.hh.
+struct ObjMap;
+
+uint32_t hashString(const char *chars, int length);
+
+// Allocates a string with room for `length` characters; the caller fills `chars` and then
+// passes it to internString(). These three return nullptr when out of memory.
+struct ObjString *allocateString(int length);
+
+// Returns the interned copy of a filled-in string, freeing `string` if one already existed
+// or if it cannot be added to the intern table.
+struct ObjString *internString(ObjString *string);
 
 struct ObjString *copyString(const char *chars, int length);
 
+// Interns a string from another thread's heap without copying it, so that heap has to outlive
+// this VM. Strings never change once interned, which is what makes sharing them safe.
+struct ObjString *adoptString(ObjString *string);
+
+// The caller sets `function` to match the signature. Returns nullptr when out of memory.
+struct ObjNative *allocateNative(ObjString *name, NativeSignature signature, uint8_t arity);
+
+// Allocates an array of `count` elements, left uninitialized, where count is at most
+// ARRAY_MAX_LENGTH. Returns nullptr when out of memory.
+struct ObjArray *allocateArray(int32_t count);
+
+// An empty map. Returns nullptr when out of memory.
+struct ObjMap *allocateMap();
+
+void freeObject(Obj *object);
+
 #endif //CLOX_OBJECT_H
@@ -0,0 +1,32 @@
+#ifndef CLOX_OUTPUT_H
+#define CLOX_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Results collect in the VM's buffer and reach the sink once it fills up or on flushOutput().
+#define OUTPUT_BUFFER_SIZE (8 * 1024)
+
+// Receives everything the VM prints, in order, a buffer at a time.
+typedef void (*OutputSink)(void *context, const char *data, size_t length);
+
+struct Output {
+    char data[OUTPUT_BUFFER_SIZE];
+    uint32_t length;
+    // Without a sink, output goes to standard output with write(2).
+    OutputSink sink;
+    void *context;
+};
+
+// Appends to the current thread's VM output; writes bigger than the buffer go straight through.
+void writeOutput(const char *data, size_t length);
+
+// Hands whatever is buffered to the sink. Called at exit, on runtime errors and before the
+// REPL waits for input; anything printed with stdio is flushed first to keep the order.
+void flushOutput();
+
+// Flushes what the previous sink has not received yet, then sends later output to `sink`.
+// nullptr restores standard output.
+void setOutputSink(OutputSink sink, void *context);
+
+#endif //CLOX_OUTPUT_H
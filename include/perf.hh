@@ -0,0 +1,42 @@
+#ifndef CLOX_PERF_H
+#define CLOX_PERF_H
+
+#include <cstdint>
+#include <cstdio>
+
+enum struct PerfPhase {
+    SCAN,
+    COMPILE,
+    EXECUTE,
+    COUNT,
+};
+
+enum struct PerfCounter {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    COUNT,
+};
+
+struct PerfPhaseStats {
+    uint64_t counters[static_cast<size_t>(PerfCounter::COUNT)];
+    uint64_t nanoseconds;
+    uint64_t runs;
+};
+
+extern bool perfStatsEnabled;
+
+// Opens the hardware counters; phases are still timed with clock_gettime when none are available.
+void enablePerfStats();
+
+void beginPerfPhase(PerfPhase phase);
+
+void endPerfPhase(PerfPhase phase);
+
+const PerfPhaseStats &perfPhaseStats(PerfPhase phase);
+
+void printPerfStats(FILE *out);
+
+#endif //CLOX_PERF_H
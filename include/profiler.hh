@@ -0,0 +1,120 @@
+#ifndef CLOX_PROFILER_H
+#define CLOX_PROFILER_H
+
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include "chunk.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+#endif
+
+// Cycle costs are only sampled on every OP_SAMPLE_INTERVAL-th instruction to keep rdtsc off the hot path.
+#define OP_SAMPLE_INTERVAL 64
+
+// SIGPROF fires every LINE_PROFILE_INTERVAL_USEC of CPU time; lines are counted in a fixed table
+// because the handler cannot allocate.
+#define LINE_PROFILE_INTERVAL_USEC 1000
+#define LINE_PROFILE_SLOTS (1 << 16)
+
+enum struct OpProfileFormat {
+    TEXT,
+    JSON,
+};
+
+struct OpProfile {
+    uint64_t counts[OPCODE_COUNT];
+    uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+    uint64_t sampledCycles[OPCODE_COUNT];
+    uint64_t samples[OPCODE_COUNT];
+    uint64_t sampleStart;
+    uint32_t countdown;
+    uint8_t previous;
+    uint8_t sampledOp;
+    bool hasPrevious;
+    bool sampling;
+};
+
+enum struct ProfilePhase : sig_atomic_t {
+    IDLE,
+    COMPILE,
+    EXECUTE,
+};
+
+// State the SIGPROF handler reads; run() republishes ip before every instruction.
+struct LineProfile {
+    const Chunk *volatile chunk;
+    const uint8_t *volatile ip;
+    volatile ProfilePhase phase;
+};
+
+extern OpProfile opProfile;
+
+extern bool opProfilerEnabled;
+
+extern LineProfile lineProfile;
+
+extern bool lineProfilerEnabled;
+
+static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+static inline void finishOpSample() {
+    if (!opProfile.sampling) return;
+    opProfile.sampledCycles[opProfile.sampledOp] += readCycles() - opProfile.sampleStart;
+    opProfile.samples[opProfile.sampledOp]++;
+    opProfile.sampling = false;
+}
+
+// Called by run() before dispatching each instruction when the profiler is enabled.
+static inline void profileOp(OpCode instruction) {
+    auto op = static_cast<uint8_t>(instruction);
+    finishOpSample();
+
+    opProfile.counts[op]++;
+    if (opProfile.hasPrevious) opProfile.pairs[opProfile.previous][op]++;
+    opProfile.previous = op;
+    opProfile.hasPrevious = true;
+
+    if (--opProfile.countdown == 0) {
+        opProfile.countdown = OP_SAMPLE_INTERVAL;
+        opProfile.sampling = true;
+        opProfile.sampledOp = op;
+        opProfile.sampleStart = readCycles();
+    }
+}
+
+// Called when run() leaves the dispatch loop so pairs never span two scripts.
+static inline void endOpProfile() {
+    finishOpSample();
+    opProfile.hasPrevious = false;
+}
+
+static inline void setProfilePhase(ProfilePhase phase) {
+    if (lineProfilerEnabled) lineProfile.phase = phase;
+}
+
+void enableOpProfiler();
+
+void printOpProfile(FILE *out, OpProfileFormat format);
+
+// Starts sampling; the collapsed stacks are written to `path` by stopLineProfiler().
+bool startLineProfiler(const char *path, const char *scriptName);
+
+void stopLineProfiler();
+
+#endif //CLOX_PROFILER_H
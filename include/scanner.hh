@@ -5,8 +5,10 @@
 #ifndef CLOX_SCANNER_H
 #define CLOX_SCANNER_H
 
+#include <cstddef>
+#include <cstdint>
 
-enum struct TokenType : u_int32_t {
+enum struct TokenType : uint32_t {
     // Single-character
     LEFT_PAREN, RIGHT_PAREN,
     LEFT_BRACE, RIGHT_BRACE,
@@ -31,6 +33,9 @@ enum struct TokenType : u_int32_t {
     ERROR, TOKEN_EOF
 };
 
+// Keep in sync with the last TokenType; sizes the per-token tables.
+constexpr size_t TOKEN_COUNT = static_cast<size_t>(TokenType::TOKEN_EOF) + 1;
+
 struct Token {
     TokenType type;
     const char *start;
@@ -38,8 +43,12 @@ struct Token {
     int32_t line;
 };
 
-void initScanner(const char *source);
+// Scans [source, source + length); tokens point into the source, which must outlive them.
+void initScanner(const char *source, size_t length);
 
 Token scanToken();
 
+// Where the source text of the last scanned token begins; differs from Token::start only for errors.
+const char *lastTokenStart();
+
 #endif //CLOX_SCANNER_H
@@ -0,0 +1,47 @@
+#ifndef CLOX_SCHEDULER_H
+#define CLOX_SCHEDULER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "vm.hh"
+
+// Instructions a script runs before the next one on its thread gets a turn.
+#define SCHEDULER_DEFAULT_QUANTUM 1000
+// A thread whose heap grows past this, or whose scripts have declared more than
+// SCHEDULER_GLOBAL_LIMIT globals between them, starts no new scripts until the ones it started
+// have finished, then starts over with a fresh VM.
+#define SCHEDULER_HEAP_LIMIT (64 * 1024 * 1024)
+#define SCHEDULER_GLOBAL_LIMIT (MAX_GLOBALS / 2)
+
+// Called on the scheduler thread that ran the script. `value` is the result on OK and lives
+// in that thread's heap, so it has to be copied out before the callback returns. `peakBytes`
+// is the most the script held at once.
+typedef void (*ScriptDone)(void *context, InterpretResult result, Value value, size_t peakBytes);
+
+struct SchedulerThread;
+
+// Runs many scripts on a few threads, each thread switching between its scripts round-robin
+// every `quantum` instructions so a short script never waits for a long one to finish.
+// A script stays on the thread it was given: its strings are interned in that thread's VM.
+struct Scheduler {
+    SchedulerThread *threads;
+    uint32_t threadCount;
+    uint32_t quantum;
+    std::atomic<uint64_t> pending;
+};
+
+void initScheduler(Scheduler *scheduler, uint32_t threads, uint32_t quantum);
+
+// Waits for the submitted scripts to finish, then stops the threads.
+void freeScheduler(Scheduler *scheduler);
+
+// The source is copied; it is compiled on the thread that will run it. Going past
+// `memoryLimit` bytes, 0 for no limit, fails the script with an out of memory error.
+void submitScript(Scheduler *scheduler, const char *source, size_t length, size_t memoryLimit,
+                  ScriptDone done, void *context);
+
+// Blocks until every script submitted so far has finished.
+void drainScheduler(Scheduler *scheduler);
+
+#endif //CLOX_SCHEDULER_H
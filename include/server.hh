@@ -0,0 +1,45 @@
+#ifndef CLOX_SERVER_H
+#define CLOX_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Every message either way is a FRAME_HEADER_SIZE header, a little-endian uint32 payload
+// length followed by a one-byte kind, and then the payload.
+#define FRAME_HEADER_SIZE 5
+// Larger requests are refused and their connection closed, as the stream cannot be resynchronized.
+#define SERVE_MAX_REQUEST (64 * 1024 * 1024)
+// A worker starts over with a fresh VM once its heap grows past this many bytes, or once
+// requests have declared more than this many globals between them.
+#define SERVE_HEAP_LIMIT (64 * 1024 * 1024)
+#define SERVE_GLOBAL_LIMIT (32 * 1024)
+
+enum struct RequestKind : uint8_t {
+    // Payload is source text; it is compiled and run once.
+    EVAL,
+    // Payload is source text to keep for RUN; the response payload is its uint32 script id.
+    REGISTER,
+    // Payload is a uint32 script id returned by REGISTER.
+    RUN,
+};
+
+enum struct ResponseStatus : uint8_t {
+    // Payload is the result value as the interpreter would print it.
+    OK,
+    COMPILE_ERROR,
+    RUNTIME_ERROR,
+    BAD_REQUEST,
+};
+
+// Returns false on EOF or error. A payload over `maxLength` is not read and reports false too.
+bool readFrame(int fd, uint8_t *kind, std::string *payload, uint32_t maxLength);
+
+bool writeFrame(int fd, uint8_t kind, const char *payload, uint32_t length);
+
+// Listens on `socketPath` until SIGINT or SIGTERM, evaluating requests on `workers` threads
+// that each own a VM. A request may allocate up to `memoryLimit` bytes, 0 for no limit.
+// Returns the process exit status.
+int serve(const char *socketPath, uint32_t workers, size_t memoryLimit);
+
+#endif //CLOX_SERVER_H
@@ -0,0 +1,30 @@
+#ifndef CLOX_SNAPSHOT_H
+#define CLOX_SNAPSHOT_H
+
+#include <cstddef>
+#include "chunk.hh"
+
+// A compiled script saved as an image of its bytecode, constants and the globals it refers
+// to, with every string it reaches laid out as a ready-made ObjString. Pointers are stored as
+// offsets into the image, so loading is one mmap and one pass over the constants.
+struct Snapshot {
+    void *mapping;
+    size_t size;
+};
+
+void initSnapshot(Snapshot *snapshot);
+
+// Unmaps the image. The VM interns the image's strings in place, so this comes after freeVM().
+void freeSnapshot(Snapshot *snapshot);
+
+// Saves `chunk`, compiled from `source`, to `path`; the file is replaced atomically. Returns
+// false when the file cannot be written or a constant is not a number, string or literal.
+bool writeSnapshot(const char *path, const Chunk *chunk, const char *source, size_t length);
+
+// Fills the empty `chunk` from the image at `path` if it was written from the same source by
+// a build with the same image format and instruction set, every operand stays inside the
+// image's constants and globals, and its globals have the same slots in this VM. Otherwise
+// returns false with `chunk` left empty. `snapshot` must not hold an image yet.
+bool loadSnapshot(Snapshot *snapshot, const char *path, const char *source, size_t length, Chunk *chunk);
+
+#endif //CLOX_SNAPSHOT_H
@@ -0,0 +1,38 @@
+#ifndef CLOX_TABLE_H
+#define CLOX_TABLE_H
+
+#include "value.hh"
+
+// Open addressing with linear probing; deleted entries leave a tombstone (null key, true value).
+#define TABLE_MAX_LOAD 0.75
+
+struct Entry {
+    ObjString *key;
+    Value value;
+};
+
+struct Table {
+    int32_t count;
+    int32_t capacity;
+    Entry *entries;
+};
+
+void initTable(Table *table);
+
+void freeTable(Table *table);
+
+bool tableGet(Table *table, ObjString *key, Value *value);
+
+// Makes room for one more key; false when the table is full and cannot grow.
+bool tableReserve(Table *table);
+
+// Returns true when `key` was not in the table yet. A new key is not stored when the table
+// cannot grow, so callers that must know reserve first.
+bool tableSet(Table *table, ObjString *key, Value value);
+
+bool tableDelete(Table *table, ObjString *key);
+
+// Looks a string up by content, which is how interning finds the canonical copy.
+ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash);
+
+#endif //CLOX_TABLE_H
@@ -0,0 +1,57 @@
+#ifndef CLOX_TOKENIZER_H
+#define CLOX_TOKENIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "scanner.hh"
+
+// Sources at least PARALLEL_SCAN_MIN_BYTES long are tokenized ahead of parsing on several
+// threads, each taking at least PARALLEL_SCAN_MIN_CHUNK bytes of it.
+#define PARALLEL_SCAN_MIN_BYTES (4 * 1024 * 1024)
+#define PARALLEL_SCAN_MIN_CHUNK (1024 * 1024)
+
+// Tokens of one source range, stored column-wise. Offsets are from the start of the whole
+// source, lines are relative to `lineBase`. An error token's `lengths` entry indexes `messages`.
+// The four columns share one allocation, which `offsets` starts.
+struct TokenSegment {
+    uint32_t *offsets;
+    uint32_t *lengths;
+    int32_t *lines;
+    TokenType *types;
+    const char **messages;
+    int32_t count;
+    int32_t capacity;
+    int32_t messageCount;
+    // Tokens before `first` were scanned from inside a string and are replaced by a repair segment.
+    int32_t first;
+    int32_t lineBase;
+    int32_t newlines;
+    bool outOfMemory;
+};
+
+// Segments alternate between a chunk scanned by one thread and the repair tokens rescanned
+// after it when a string literal crosses into the next chunk.
+struct TokenBuffer {
+    const char *source;
+    TokenSegment *segments;
+    int32_t segmentCount;
+    int32_t segment;
+    int32_t next;
+    // Set when the tokens did not fit in memory; the buffer then yields only an error token.
+    bool outOfMemory;
+};
+
+// Threads used for tokenizing; 0 picks the hardware concurrency.
+extern uint32_t scanThreads;
+
+// Returns false, leaving `buffer` empty, when the source is too small to be worth splitting.
+// Memory is charged to the calling thread's quota. When it runs out, the buffer yields the
+// error token "Out of memory." followed by TOKEN_EOF, which the compiler reports like any other.
+bool tokenizeParallel(const char *source, size_t length, TokenBuffer *buffer);
+
+// Returns tokens in source order, ending with TOKEN_EOF.
+Token nextToken(TokenBuffer *buffer);
+
+void freeTokenBuffer(TokenBuffer *buffer);
+
+#endif //CLOX_TOKENIZER_H
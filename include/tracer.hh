@@ -0,0 +1,46 @@
+#ifndef CLOX_TRACER_H
+#define CLOX_TRACER_H
+
+#include <atomic>
+#include "chunk.hh"
+
+#define TRACE_DEFAULT_EVENTS 8192
+#define TRACE_EMPTY_STACK UINT8_MAX
+
+// One dispatched instruction; the opcode is redundant with the chunk but lets a dump be read without it.
+struct TraceEvent {
+    uint32_t offset;
+    uint8_t opcode;
+    uint8_t top;
+    uint16_t depth;
+};
+
+static_assert(sizeof(TraceEvent) == 8);
+
+// Single-producer ring: run() is the only writer, dumps only ever read behind `head`.
+struct TraceRing {
+    TraceEvent *events{};
+    uint32_t mask{};
+    std::atomic<uint64_t> head{};
+};
+
+extern TraceRing traceRing;
+
+extern bool tracerEnabled;
+
+static inline void traceInstruction(uint32_t offset, uint8_t opcode, uint8_t top, uint16_t depth) {
+    uint64_t head = traceRing.head.load(std::memory_order_relaxed);
+    traceRing.events[head & traceRing.mask] = {offset, opcode, top, depth};
+    traceRing.head.store(head + 1, std::memory_order_release);
+}
+
+// Rounds `events` up to a power of two; SIGUSR1 dumps the ring to `path` on demand.
+bool enableTracer(uint32_t events, const char *path);
+
+// Writes the ring to the configured path using only async-signal-safe calls.
+bool dumpTrace();
+
+// Prints a dump as disassembly of `chunk`, which must be compiled from the traced script.
+bool decodeTrace(const char *path, Chunk *chunk);
+
+#endif //CLOX_TRACER_H
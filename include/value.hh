@@ -5,17 +5,22 @@
 #ifndef CLOX_VALUE_H
 #define CLOX_VALUE_H
 
+#include <cinttypes>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
-#include <iostream>
 #include "object.hh"
 #include "memory.hh"
+#include "number.hh"
+#include "output.hh"
 
-enum struct ValueType {
+enum struct ValueType : uint8_t {
     BOOL,
     NIL,
     NUMBER,
     OBJECT,
+    // Integer literals and the sums, differences and products of integers, while they fit.
+    INTEGER,
 };
 
 class Value {
@@ -24,18 +29,27 @@ public:
     union {
         bool boolean;
         double number;
+        int64_t integer;
         Obj *obj;
     } as;
 
-    explicit Value(bool boolean) : type(ValueType::BOOL), as({.boolean = boolean}) {}
+    constexpr explicit Value(bool boolean) : type(ValueType::BOOL), as({.boolean = boolean}) {}
 
-    explicit Value(double number) : type(ValueType::NUMBER), as({.number = number}) {}
+    constexpr explicit Value(double number) : type(ValueType::NUMBER), as({.number = number}) {}
 
-    explicit Value(Obj *obj) : type(ValueType::OBJECT), as({.obj = obj}) {}
+    constexpr explicit Value(int64_t integer) : type(ValueType::INTEGER), as({.integer = integer}) {}
+
+    constexpr explicit Value(Obj *obj) : type(ValueType::OBJECT), as({.obj = obj}) {}
 
     explicit Value(ObjString *obj) : type(ValueType::OBJECT), as({.obj = (Obj *) obj}) {}
 
-    explicit Value() : type(ValueType::NIL), as({.number = 0}) {}
+    explicit Value(ObjNative *obj) : type(ValueType::OBJECT), as({.obj = (Obj *) obj}) {}
+
+    explicit Value(ObjArray *obj) : type(ValueType::OBJECT), as({.obj = (Obj *) obj}) {}
+
+    explicit Value(ObjMap *obj) : type(ValueType::OBJECT), as({.obj = (Obj *) obj}) {}
+
+    constexpr explicit Value() : type(ValueType::NIL), as({.number = 0}) {}
 
 
     constexpr bool isFalsey() const {
@@ -46,24 +60,48 @@ public:
 
     constexpr bool isNil() const { return type == ValueType::NIL; }
 
-    constexpr bool isNumber() const { return type == ValueType::NUMBER; }
+    // Either kind of number; isDouble() and isInteger() tell them apart.
+    constexpr bool isNumber() const { return isDouble() || isInteger(); }
+
+    constexpr bool isDouble() const { return type == ValueType::NUMBER; }
+
+    constexpr bool isInteger() const { return type == ValueType::INTEGER; }
 
     constexpr bool isObject() const { return type == ValueType::OBJECT; }
 
     constexpr bool isString() const { return isObjType(ObjectType::STRING); }
 
+    constexpr bool isNative() const { return isObjType(ObjectType::NATIVE); }
+
+    constexpr bool isArray() const { return isObjType(ObjectType::ARRAY); }
+
+    constexpr bool isMap() const { return isObjType(ObjectType::MAP); }
+
     Obj *asObject() const { return as.obj; }
 
     bool asBool() const { return as.boolean; }
 
-    double asNumber() const { return as.number; }
+    // Converts an integer, so it works for either kind of number.
+    double asNumber() const { return isInteger() ? (double) as.integer : as.number; }
+
+    int64_t asInteger() const { return as.integer; }
 
     ObjString *asString() const { return (ObjString *) (asObject()); }
 
+    ObjNative *asNative() const { return (ObjNative *) (asObject()); }
+
+    ObjArray *asArray() const { return (ObjArray *) (asObject()); }
+
+    ObjMap *asMap() const { return (ObjMap *) (asObject()); }
+
     const char *asCString() const { return ((ObjString *) asObject())->chars; }
 
     auto operator==(Value a) const {
-        if (type != a.type) return false;
+        if (type != a.type) {
+            if (isInteger() && a.isDouble()) return integerEquals(asInteger(), a.as.number);
+            if (isDouble() && a.isInteger()) return integerEquals(a.asInteger(), as.number);
+            return false;
+        }
         switch (type) {
             case ValueType::BOOL:
                 return asBool() == a.asBool();
@@ -71,35 +109,69 @@ public:
                 return true;
             case ValueType::NUMBER:
                 return asNumber() == a.asNumber();
-            case ValueType::OBJECT: {
-                ObjString *aString = asString();
-                ObjString *bString = a.asString();
-                return aString->length == bString->length &&
-                       memcmp(aString->chars, bString->chars, aString->length) == 0;
-            }
+            case ValueType::OBJECT:
+                return asObject() == a.asObject();
+            case ValueType::INTEGER:
+                return asInteger() == a.asInteger();
             default:
                 return false;
         }
     }
 
-    void print() {
+    // Appends the value to the VM's output.
+    void print() const {
         switch (type) {
             case ValueType::BOOL:
-                printf(asBool() ? "true" : "false");
+                if (asBool()) {
+                    writeOutput("true", 4);
+                } else {
+                    writeOutput("false", 5);
+                }
                 break;
             case ValueType::NIL:
-                printf("nil");
+                writeOutput("nil", 3);
                 break;
-            case ValueType::NUMBER:
-                printf("%g", asNumber());
+            case ValueType::NUMBER: {
+                char text[DOUBLE_BUFFER_SIZE];
+                writeOutput(text, formatDouble(asNumber(), text));
                 break;
+            }
             case ValueType::OBJECT:
                 printObject();
                 break;
+            case ValueType::INTEGER: {
+                char text[DOUBLE_BUFFER_SIZE];
+                writeOutput(text, snprintf(text, sizeof(text), "%" PRId64, asInteger()));
+                break;
+            }
         }
     }
 
+    // Writes what print() would into `buffer`, with snprintf's return value and truncation.
+    int format(char *buffer, size_t size) const {
+        switch (type) {
+            case ValueType::BOOL:
+                return snprintf(buffer, size, "%s", asBool() ? "true" : "false");
+            case ValueType::NIL:
+                return snprintf(buffer, size, "nil");
+            case ValueType::NUMBER: {
+                char text[DOUBLE_BUFFER_SIZE];
+                return snprintf(buffer, size, "%.*s", formatDouble(asNumber(), text), text);
+            }
+            case ValueType::OBJECT:
+                return formatObject(buffer, size);
+            case ValueType::INTEGER:
+                return snprintf(buffer, size, "%" PRId64, asInteger());
+        }
+        return 0;
+    }
+
 private:
+    // Exact, where comparing as doubles would round integers past 2^53.
+    static bool integerEquals(int64_t integer, double number) {
+        return number == (double) integer && number >= -0x1p63 && number < 0x1p63 && (int64_t) number == integer;
+    }
+
     constexpr inline bool isObjType(ObjectType objectType) const {
         return isObject() && asObject()->type == objectType;
     }
@@ -107,9 +179,54 @@ private:
     void printObject() const {
         switch (asObject()->type) {
             case ObjectType::STRING:
-                std::cout << asString()->chars << std::endl;
+                writeOutput(asString()->chars, asString()->length);
                 break;
+            case ObjectType::NATIVE:
+                writeOutput("<native ", 8);
+                writeOutput(asNative()->name->chars, asNative()->name->length);
+                writeOutput(">", 1);
+                break;
+            case ObjectType::ARRAY:
+                writeOutput("[", 1);
+                for (int32_t i = 0; i < asArray()->count; i++) {
+                    char text[DOUBLE_BUFFER_SIZE];
+                    if (i > 0) writeOutput(", ", 2);
+                    writeOutput(text, formatDouble(asArray()->values[i], text));
+                }
+                writeOutput("]", 1);
+                break;
+            case ObjectType::MAP:
+                writeOutput("<map>", 5);
+                break;
+        }
+    }
+
+    int formatObject(char *buffer, size_t size) const {
+        switch (asObject()->type) {
+            case ObjectType::STRING:
+                return snprintf(buffer, size, "%.*s", asString()->length, asString()->chars);
+            case ObjectType::NATIVE:
+                return snprintf(buffer, size, "<native %.*s>", asNative()->name->length, asNative()->name->chars);
+            case ObjectType::ARRAY: {
+                // Every piece goes after what fitted so far; the total counts what did not.
+                size_t length = 0;
+                auto append = [&](const char *text, int textLength) {
+                    if (length < size) snprintf(buffer + length, size - length, "%.*s", textLength, text);
+                    length += textLength;
+                };
+                append("[", 1);
+                for (int32_t i = 0; i < asArray()->count; i++) {
+                    char text[DOUBLE_BUFFER_SIZE];
+                    if (i > 0) append(", ", 2);
+                    append(text, formatDouble(asArray()->values[i], text));
+                }
+                append("]", 1);
+                return (int) length;
+            }
+            case ObjectType::MAP:
+                return snprintf(buffer, size, "<map>");
         }
+        return 0;
     }
 };
 
@@ -121,31 +238,35 @@ struct ValueArray {
     ValueArray() : capacity(0), count(0), values(nullptr) {}
 
     ~ValueArray() {
-        reallocate(values, sizeof(Value) * capacity, 0);
+        reallocate(values, sizeof(Value) * capacity, 0, MemoryCategory::CONSTANTS);
     }
 
     void free() {
-        reallocate(values, sizeof(Value) * capacity, 0);
+        reallocate(values, sizeof(Value) * capacity, 0, MemoryCategory::CONSTANTS);
         values = nullptr;
         capacity = 0;
         count = 0;
     }
 
-    void write(Value value) {
+    bool write(Value value) {
         if (capacity < count + 1) {
             int32_t oldCapacity = capacity;
+            Value *grown = GROW_ARRAY(Value, values, oldCapacity, GROW_CAPACITY(oldCapacity), MemoryCategory::CONSTANTS);
+            if (grown == nullptr) return false;
+            values = grown;
             capacity = GROW_CAPACITY(oldCapacity);
-            values = GROW_ARRAY(Value, values, oldCapacity, capacity);
         }
 
         values[count] = value;
         count++;
+        return true;
     }
 };
 
 void initValueArray(ValueArray *array);
 
-void writeValueArray(ValueArray *array, Value value);
+// Returns false, leaving the array as it was, when it cannot grow.
+bool writeValueArray(ValueArray *array, Value value);
 
 void freeValueArray(ValueArray *array);
 
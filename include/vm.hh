@@ -6,28 +6,124 @@
 #define CLOX_VM_H
 
 #include "chunk.hh"
+#include "memory.hh"
+#include "output.hh"
+#include "snapshot.hh"
+#include "table.hh"
 
 #define STACK_MAX 256
+// Bytes a string concatenation may produce per instruction of budget it is charged.
+#define BUDGET_BYTES_PER_INSTRUCTION 64
+// Array elements an arithmetic instruction may process per instruction of budget it is charged.
+#define BUDGET_ELEMENTS_PER_INSTRUCTION 64
+// Global slots are a two-byte operand.
+#define MAX_GLOBALS (UINT16_MAX + 1)
+
+// A global variable. The compiler resolves names to indices into VM::globals once, so an
+// access is an array load; `bound` is what the host gave the name and what resetGlobals()
+// goes back to.
+struct Global {
+    Value value;
+    bool defined;
+    bool hostBound;
+    // Listed in VM::writtenGlobals.
+    bool written;
+    ObjString *name;
+    Value bound;
+};
 
 struct VM {
     Chunk *chunk{};
     uint8_t *ip{};
     Value stack[STACK_MAX];
     Value *stackTop{};
+    Table strings{};
+    // Slot index of every global name, as a Value holding an integer.
+    Table globalNames{};
+    Global *globals{};
+    int32_t globalCount{};
+    int32_t globalCapacity{};
+    // Slots a script defined or assigned since the last resetGlobals(), each once; only these
+    // can differ from what the host bound. Has room for globalCapacity slots.
+    int32_t *writtenGlobals{};
+    int32_t writtenGlobalCount{};
+    // Charged with everything allocated while this VM is current; initVM() keeps the limit.
+    MemoryQuota memory{};
+    // When set, RETURN stores the value in `result` instead of printing it.
+    bool captureResult{};
+    Value result{};
+    // Instructions runBudgeted() may still execute before it yields.
+    uint32_t budget{};
+    // Why the native being called failed, if it said; see nativeError().
+    const char *nativeError{};
+    // What RETURN prints, until flushed; initVM() keeps the sink.
+    Output output{};
 };
 
+// One VM per thread. constinit lets other translation units access it without a TLS wrapper call.
+extern thread_local constinit VM vm;
+
 enum struct InterpretResult {
     OK,
     COMPILE_ERROR,
     RUNTIME_ERROR,
+    // Only from runBudgeted(): the budget ran out with more of the chunk left to run.
+    YIELD,
 };
 
-void initVM();
+// Returns false when out of memory before every standard native was defined; the VM still
+// has to be freed.
+bool initVM();
 
 void freeVM();
 
-InterpretResult interpret(const char *source);
+InterpretResult interpret(const char *source, size_t length);
+
+// Runs an already compiled chunk; the caller keeps ownership of it.
+InterpretResult interpretChunk(Chunk *chunk);
+
+// Like interpret(), but for a warm start: runs the chunk saved at `path` when it was compiled
+// from this source, and otherwise compiles and saves it there before running. Keep `snapshot`
+// until after freeVM(), as the VM uses the image's strings in place.
+InterpretResult interpretSnapshot(const char *source, size_t length, const char *path, Snapshot *snapshot);
+
+// Runs a chunk from compileStage() on `input`.
+InterpretResult interpretStage(Chunk *chunk, Value input);
+
+// A REPL session compiles every input onto the end of one chunk, so the constant pool and
+// the strings interned by earlier inputs carry over instead of being rebuilt per line.
+struct Session {
+    Chunk chunk;
+};
+
+void initSession(Session *session);
+
+void freeSession(Session *session);
+
+InterpretResult interpretSession(Session *session, const char *source, size_t length);
 
 InterpretResult run();
 
+// The slot for a global name, allocated on first use; -1 when out of memory or out of slots.
+int32_t globalSlot(ObjString *name);
+
+// Binds a host value to a global, e.g. a script's inputs, and returns its slot; -1 when out of
+// memory. Scripts can read it like any other global.
+int32_t defineGlobal(const char *name, Value value);
+
+// Rebinds a slot returned by defineGlobal() without looking the name up again.
+void setGlobal(int32_t slot, Value value);
+
+// Defines a global the way a script does, e.g. to hand a suspended script its variables back;
+// resetGlobals() undoes it.
+void writeGlobal(int32_t slot, Value value);
+
+// Undefines the globals scripts defined and restores the ones the host bound, so unrelated
+// scripts sharing this VM do not see each other's variables. Only the written slots are visited.
+void resetGlobals();
+
+// Runs vm.chunk from vm.ip for at most `budget` instructions. On YIELD, vm.ip and the stack
+// are left where the next call continues from; the profilers and the tracer are not applied.
+InterpretResult runBudgeted(uint32_t budget);
+
 #endif //CLOX_VM_H
@@ -0,0 +1,282 @@
+#include <cmath>
+#include "array.hh"
+
+// The kernels work on as many elements at once as a vector register holds. Element storage
+// is aligned, so loads and stores at multiples of LANE_COUNT use the aligned forms.
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define LANE_COUNT 4
+typedef __m256d Lanes;
+
+static inline Lanes loadLanes(const double *values) { return _mm256_load_pd(values); }
+
+static inline void storeLanes(double *values, Lanes lanes) { _mm256_store_pd(values, lanes); }
+
+static inline Lanes splatLanes(double value) { return _mm256_set1_pd(value); }
+
+static inline Lanes addLanes(Lanes a, Lanes b) { return _mm256_add_pd(a, b); }
+
+static inline Lanes subtractLanes(Lanes a, Lanes b) { return _mm256_sub_pd(a, b); }
+
+static inline Lanes multiplyLanes(Lanes a, Lanes b) { return _mm256_mul_pd(a, b); }
+
+static inline Lanes divideLanes(Lanes a, Lanes b) { return _mm256_div_pd(a, b); }
+
+// A comparison mask is all ones or all zeros, so masking 1.0 with it gives 1 or 0.
+static inline Lanes equalLanes(Lanes a, Lanes b) {
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ), _mm256_set1_pd(1.0));
+}
+
+static inline Lanes greaterLanes(Lanes a, Lanes b) {
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ), _mm256_set1_pd(1.0));
+}
+
+static inline Lanes lessLanes(Lanes a, Lanes b) {
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), _mm256_set1_pd(1.0));
+}
+
+static inline Lanes greaterEqualLanes(Lanes a, Lanes b) {
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GE_OQ), _mm256_set1_pd(1.0));
+}
+
+static inline Lanes lessEqualLanes(Lanes a, Lanes b) {
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ), _mm256_set1_pd(1.0));
+}
+
+static inline Lanes negateLanes(Lanes a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+
+// Both return `b` when either is NaN, so a NaN in `a` leaves the accumulator as it was.
+static inline Lanes minLanes(Lanes a, Lanes b) { return _mm256_min_pd(a, b); }
+
+static inline Lanes maxLanes(Lanes a, Lanes b) { return _mm256_max_pd(a, b); }
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define LANE_COUNT 2
+typedef __m128d Lanes;
+
+static inline Lanes loadLanes(const double *values) { return _mm_load_pd(values); }
+
+static inline void storeLanes(double *values, Lanes lanes) { _mm_store_pd(values, lanes); }
+
+static inline Lanes splatLanes(double value) { return _mm_set1_pd(value); }
+
+static inline Lanes addLanes(Lanes a, Lanes b) { return _mm_add_pd(a, b); }
+
+static inline Lanes subtractLanes(Lanes a, Lanes b) { return _mm_sub_pd(a, b); }
+
+static inline Lanes multiplyLanes(Lanes a, Lanes b) { return _mm_mul_pd(a, b); }
+
+static inline Lanes divideLanes(Lanes a, Lanes b) { return _mm_div_pd(a, b); }
+
+// A comparison mask is all ones or all zeros, so masking 1.0 with it gives 1 or 0.
+static inline Lanes equalLanes(Lanes a, Lanes b) { return _mm_and_pd(_mm_cmpeq_pd(a, b), _mm_set1_pd(1.0)); }
+
+static inline Lanes greaterLanes(Lanes a, Lanes b) { return _mm_and_pd(_mm_cmpgt_pd(a, b), _mm_set1_pd(1.0)); }
+
+static inline Lanes lessLanes(Lanes a, Lanes b) { return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1.0)); }
+
+static inline Lanes greaterEqualLanes(Lanes a, Lanes b) { return _mm_and_pd(_mm_cmpge_pd(a, b), _mm_set1_pd(1.0)); }
+
+static inline Lanes lessEqualLanes(Lanes a, Lanes b) { return _mm_and_pd(_mm_cmple_pd(a, b), _mm_set1_pd(1.0)); }
+
+static inline Lanes negateLanes(Lanes a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+
+// Both return `b` when either is NaN, so a NaN in `a` leaves the accumulator as it was.
+static inline Lanes minLanes(Lanes a, Lanes b) { return _mm_min_pd(a, b); }
+
+static inline Lanes maxLanes(Lanes a, Lanes b) { return _mm_max_pd(a, b); }
+
+#else
+
+// Without SIMD a lane is one double, with the same semantics as the vector forms.
+#define LANE_COUNT 1
+typedef double Lanes;
+
+static inline Lanes loadLanes(const double *values) { return *values; }
+
+static inline void storeLanes(double *values, Lanes lanes) { *values = lanes; }
+
+static inline Lanes splatLanes(double value) { return value; }
+
+static inline Lanes addLanes(Lanes a, Lanes b) { return a + b; }
+
+static inline Lanes subtractLanes(Lanes a, Lanes b) { return a - b; }
+
+static inline Lanes multiplyLanes(Lanes a, Lanes b) { return a * b; }
+
+static inline Lanes divideLanes(Lanes a, Lanes b) { return a / b; }
+
+static inline Lanes equalLanes(Lanes a, Lanes b) { return a == b ? 1.0 : 0.0; }
+
+static inline Lanes greaterLanes(Lanes a, Lanes b) { return a > b ? 1.0 : 0.0; }
+
+static inline Lanes lessLanes(Lanes a, Lanes b) { return a < b ? 1.0 : 0.0; }
+
+static inline Lanes greaterEqualLanes(Lanes a, Lanes b) { return a >= b ? 1.0 : 0.0; }
+
+static inline Lanes lessEqualLanes(Lanes a, Lanes b) { return a <= b ? 1.0 : 0.0; }
+
+static inline Lanes negateLanes(Lanes a) { return -a; }
+
+static inline Lanes minLanes(Lanes a, Lanes b) { return a < b ? a : b; }
+
+static inline Lanes maxLanes(Lanes a, Lanes b) { return a > b ? a : b; }
+
+#endif
+
+// Independent accumulators per reduction, so consecutive adds do not wait on each other.
+#define ACCUMULATORS 4
+
+template<ArrayOp OP>
+static inline Lanes applyLanes(Lanes a, Lanes b) {
+    if constexpr (OP == ArrayOp::ADD) return addLanes(a, b);
+    if constexpr (OP == ArrayOp::SUBTRACT) return subtractLanes(a, b);
+    if constexpr (OP == ArrayOp::MULTIPLY) return multiplyLanes(a, b);
+    if constexpr (OP == ArrayOp::DIVIDE) return divideLanes(a, b);
+    if constexpr (OP == ArrayOp::EQUAL) return equalLanes(a, b);
+    if constexpr (OP == ArrayOp::GREATER) return greaterLanes(a, b);
+    if constexpr (OP == ArrayOp::LESS) return lessLanes(a, b);
+    if constexpr (OP == ArrayOp::GREATER_EQUAL) return greaterEqualLanes(a, b);
+    if constexpr (OP == ArrayOp::LESS_EQUAL) return lessEqualLanes(a, b);
+    if constexpr (OP == ArrayOp::NEGATE) return negateLanes(a);
+}
+
+// The elements past the last full vector.
+template<ArrayOp OP>
+static inline double applyScalar(double a, double b) {
+    if constexpr (OP == ArrayOp::ADD) return a + b;
+    if constexpr (OP == ArrayOp::SUBTRACT) return a - b;
+    if constexpr (OP == ArrayOp::MULTIPLY) return a * b;
+    if constexpr (OP == ArrayOp::DIVIDE) return a / b;
+    if constexpr (OP == ArrayOp::EQUAL) return a == b ? 1.0 : 0.0;
+    if constexpr (OP == ArrayOp::GREATER) return a > b ? 1.0 : 0.0;
+    if constexpr (OP == ArrayOp::LESS) return a < b ? 1.0 : 0.0;
+    if constexpr (OP == ArrayOp::GREATER_EQUAL) return a >= b ? 1.0 : 0.0;
+    if constexpr (OP == ArrayOp::LESS_EQUAL) return a <= b ? 1.0 : 0.0;
+    if constexpr (OP == ArrayOp::NEGATE) return -a;
+}
+
+template<ArrayOp OP, bool SCALAR_A, bool SCALAR_B>
+static void applyKernel(const double *a, const double *b, double *out, int32_t count) {
+    // An empty array's storage may end before a whole double.
+    Lanes splatA = SCALAR_A ? splatLanes(*a) : Lanes{};
+    Lanes splatB = SCALAR_B ? splatLanes(*b) : Lanes{};
+    int32_t i = 0;
+    for (; i + LANE_COUNT <= count; i += LANE_COUNT) {
+        storeLanes(out + i, applyLanes<OP>(SCALAR_A ? splatA : loadLanes(a + i),
+                                           SCALAR_B ? splatB : loadLanes(b + i)));
+    }
+    for (; i < count; i++) out[i] = applyScalar<OP>(SCALAR_A ? *a : a[i], SCALAR_B ? *b : b[i]);
+}
+
+template<ArrayOp OP>
+static void applyBinary(const double *a, bool scalarA, const double *b, bool scalarB, double *out, int32_t count) {
+    if (scalarA) {
+        applyKernel<OP, true, false>(a, b, out, count);
+    } else if (scalarB) {
+        applyKernel<OP, false, true>(a, b, out, count);
+    } else {
+        applyKernel<OP, false, false>(a, b, out, count);
+    }
+}
+
+void applyArrayOp(ArrayOp op, const double *a, bool scalarA, const double *b, bool scalarB, double *out,
+                  int32_t count) {
+    switch (op) {
+        case ArrayOp::ADD:
+            return applyBinary<ArrayOp::ADD>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::SUBTRACT:
+            return applyBinary<ArrayOp::SUBTRACT>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::MULTIPLY:
+            return applyBinary<ArrayOp::MULTIPLY>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::DIVIDE:
+            return applyBinary<ArrayOp::DIVIDE>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::EQUAL:
+            return applyBinary<ArrayOp::EQUAL>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::GREATER:
+            return applyBinary<ArrayOp::GREATER>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::LESS:
+            return applyBinary<ArrayOp::LESS>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::GREATER_EQUAL:
+            return applyBinary<ArrayOp::GREATER_EQUAL>(a, scalarA, b, scalarB, out, count);
+        case ArrayOp::LESS_EQUAL:
+            return applyBinary<ArrayOp::LESS_EQUAL>(a, scalarA, b, scalarB, out, count);
+        default:
+            return;
+    }
+}
+
+void applyArrayUnary(ArrayOp op, const double *a, double *out, int32_t count) {
+    switch (op) {
+        case ArrayOp::NEGATE:
+            return applyKernel<ArrayOp::NEGATE, false, false>(a, a, out, count);
+        default:
+            return;
+    }
+}
+
+enum struct Reduction {
+    SUM,
+    DOT,
+    MIN,
+    MAX,
+};
+
+template<Reduction R>
+static inline Lanes accumulateLanes(Lanes accumulator, const double *a, const double *b) {
+    if constexpr (R == Reduction::SUM) return addLanes(accumulator, loadLanes(a));
+    if constexpr (R == Reduction::DOT) return addLanes(accumulator, multiplyLanes(loadLanes(a), loadLanes(b)));
+    if constexpr (R == Reduction::MIN) return minLanes(loadLanes(a), accumulator);
+    if constexpr (R == Reduction::MAX) return maxLanes(loadLanes(a), accumulator);
+}
+
+template<Reduction R>
+static inline double accumulateScalar(double accumulator, double a, double b) {
+    if constexpr (R == Reduction::SUM) return accumulator + a;
+    if constexpr (R == Reduction::DOT) return accumulator + a * b;
+    if constexpr (R == Reduction::MIN) return a < accumulator ? a : accumulator;
+    if constexpr (R == Reduction::MAX) return a > accumulator ? a : accumulator;
+}
+
+template<Reduction R>
+static double reduce(const double *a, const double *b, int32_t count, double identity) {
+    Lanes accumulators[ACCUMULATORS];
+    for (Lanes &accumulator: accumulators) accumulator = splatLanes(identity);
+    int32_t i = 0;
+    for (; i + ACCUMULATORS * LANE_COUNT <= count; i += ACCUMULATORS * LANE_COUNT) {
+        for (int32_t j = 0; j < ACCUMULATORS; j++) {
+            accumulators[j] = accumulateLanes<R>(accumulators[j], a + i + j * LANE_COUNT, b + i + j * LANE_COUNT);
+        }
+    }
+    for (; i + LANE_COUNT <= count; i += LANE_COUNT) {
+        accumulators[0] = accumulateLanes<R>(accumulators[0], a + i, b + i);
+    }
+
+    alignas(sizeof(Lanes)) double lanes[ACCUMULATORS * LANE_COUNT];
+    for (int32_t j = 0; j < ACCUMULATORS; j++) storeLanes(lanes + j * LANE_COUNT, accumulators[j]);
+    double result = identity;
+    for (double lane: lanes) result = R == Reduction::DOT ? result + lane : accumulateScalar<R>(result, lane, 0);
+    for (; i < count; i++) result = accumulateScalar<R>(result, a[i], b[i]);
+    return result;
+}
+
+double arraySum(const double *values, int32_t count) {
+    return reduce<Reduction::SUM>(values, values, count, 0.0);
+}
+
+double arrayDot(const double *a, const double *b, int32_t count) {
+    return reduce<Reduction::DOT>(a, b, count, 0.0);
+}
+
+double arrayMin(const double *values, int32_t count) {
+    return reduce<Reduction::MIN>(values, values, count, INFINITY);
+}
+
+double arrayMax(const double *values, int32_t count) {
+    return reduce<Reduction::MAX>(values, values, count, -INFINITY);
+}
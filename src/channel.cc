@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include "channel.hh"
+#include "object.hh"
+
+// A cell is free for the sender at position p when its sequence is p, and holds a value for
+// the receiver at position p when it is p + 1; receiving moves it on to p + capacity.
+struct ChannelCell {
+    std::atomic<uint64_t> sequence;
+    Value value;
+    // The end of the stream, sent by the last producer to close the channel.
+    bool end;
+};
+
+void initChannel(Channel *channel, uint32_t capacity, uint32_t producers) {
+    capacity = std::bit_ceil(std::max(capacity, 2u));
+    channel->cells = new ChannelCell[capacity];
+    for (uint32_t i = 0; i < capacity; i++) channel->cells[i].sequence = i;
+    channel->mask = capacity - 1;
+    channel->sendPosition = 0;
+    channel->receivePosition = 0;
+    channel->producers = producers;
+}
+
+void freeChannel(Channel *channel) {
+    delete[] channel->cells;
+    channel->cells = nullptr;
+}
+
+// Waiting goes through the cell's own sequence, so the thread that fills or empties it is
+// the one that wakes the waiter, and an idle channel costs no system calls.
+static void push(Channel *channel, Value value, bool end) {
+    for (;;) {
+        uint64_t position = channel->sendPosition.load(std::memory_order_relaxed);
+        ChannelCell *cell = &channel->cells[position & channel->mask];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = (int64_t) (sequence - position);
+        if (difference == 0) {
+            if (channel->sendPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell->value = value;
+                cell->end = end;
+                cell->sequence.store(position + 1, std::memory_order_release);
+                cell->sequence.notify_all();
+                return;
+            }
+        } else if (difference < 0) {
+            cell->sequence.wait(sequence, std::memory_order_acquire);
+        }
+    }
+}
+
+// Swaps a string or array from the sender's heap for a copy in the calling thread's.
+static bool copyIn(Value *value) {
+    if (value->isString()) {
+        ObjString *string = copyString(value->asString()->chars, value->asString()->length);
+        if (string == nullptr) return false;
+        *value = Value(string);
+    } else if (value->isArray()) {
+        ObjArray *array = allocateArray(value->asArray()->count);
+        if (array == nullptr) return false;
+        memcpy(array->values, value->asArray()->values, sizeof(double) * array->count);
+        *value = Value(array);
+    }
+    return true;
+}
+
+// The cell is only given back once its value has been copied in, which drainChannel() relies on.
+static ReceiveResult pop(Channel *channel, Value *value) {
+    for (;;) {
+        uint64_t position = channel->receivePosition.load(std::memory_order_relaxed);
+        ChannelCell *cell = &channel->cells[position & channel->mask];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = (int64_t) (sequence - (position + 1));
+        if (difference == 0) {
+            if (channel->receivePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                *value = cell->value;
+                ReceiveResult result = ReceiveResult::OK;
+                if (cell->end) {
+                    result = ReceiveResult::CLOSED;
+                } else if (!copyIn(value)) {
+                    *value = Value();
+                    result = ReceiveResult::OUT_OF_MEMORY;
+                }
+                cell->sequence.store(position + channel->mask + 1, std::memory_order_release);
+                cell->sequence.notify_all();
+                return result;
+            }
+        } else if (difference < 0) {
+            cell->sequence.wait(sequence, std::memory_order_acquire);
+        }
+    }
+}
+
+void sendMessage(Channel *channel, Value value) {
+    push(channel, value, false);
+}
+
+ReceiveResult receiveMessage(Channel *channel, Value *value) {
+    ReceiveResult result = pop(channel, value);
+    // Put the end back for the other receivers; the producers are gone, so there is room.
+    if (result == ReceiveResult::CLOSED) push(channel, Value(), true);
+    return result;
+}
+
+// A position p below the send position has been received once its cell's sequence reaches
+// p + capacity; anything earlier than the last capacity positions was received before its
+// cell could be sent into again. The end of the stream is put back by every receiver and
+// stays behind, but it points into no heap.
+void drainChannel(Channel *channel) {
+    uint64_t capacity = channel->mask + 1;
+    uint64_t end = channel->sendPosition.load(std::memory_order_acquire);
+    for (uint64_t position = end > capacity ? end - capacity : 0; position < end; position++) {
+        ChannelCell *cell = &channel->cells[position & channel->mask];
+        for (;;) {
+            uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+            if ((int64_t) (sequence - (position + capacity)) >= 0) break;
+            if (sequence == position + 1 && cell->end) break;
+            cell->sequence.wait(sequence, std::memory_order_acquire);
+        }
+    }
+}
+
+void closeChannel(Channel *channel) {
+    if (--channel->producers == 0) push(channel, Value(), true);
+}
@@ -14,27 +14,37 @@ void initChunk(Chunk *chunk) {
 }
 
 void freeChunk(Chunk *chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int32_t, chunk->lines, chunk->capacity);
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MemoryCategory::CODE);
+    FREE_ARRAY(int32_t, chunk->lines, chunk->capacity, MemoryCategory::LINES);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
 
-void writeChunk(Chunk *chunk, uint8_t byte, int32_t line) {
+bool writeChunk(Chunk *chunk, uint8_t byte, int32_t line) {
     if (chunk->capacity < chunk->count + 1) {
         int32_t oldCapacity = chunk->capacity;
-        chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int32_t, chunk->lines, oldCapacity, chunk->capacity);
+        int32_t capacity = GROW_CAPACITY(oldCapacity);
+        uint8_t *code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, capacity, MemoryCategory::CODE);
+        if (code == nullptr) return false;
+        chunk->code = code;
+        int32_t *lines = GROW_ARRAY(int32_t, chunk->lines, oldCapacity, capacity, MemoryCategory::LINES);
+        if (lines == nullptr) {
+            // Both arrays are sized by `capacity`, so the code goes back to the old size.
+            chunk->code = GROW_ARRAY(uint8_t, chunk->code, capacity, oldCapacity, MemoryCategory::CODE);
+            return false;
+        }
+        chunk->lines = lines;
+        chunk->capacity = capacity;
     }
 
     chunk->code[chunk->count] = byte;
     chunk->lines[chunk->count] = line;
     chunk->count++;
+    return true;
 }
 
-int addConstant(Chunk *chunk, Value value) {
-    writeValueArray(&chunk->constants, value);
+int32_t addConstant(Chunk *chunk, Value value) {
+    if (!writeValueArray(&chunk->constants, value)) return -1;
     return chunk->constants.count - 1;
 }
 
@@ -2,10 +2,15 @@
 // Created by Sergei Lukaushkin on 17.06.2023.
 //
 
+#include <array>
 #include <cstdlib>
-#include <unordered_map>
+#include <cstring>
 #include "compiler.hh"
+#include "native.hh"
+#include "vm.hh"
+#include "number.hh"
 #include "scanner.hh"
+#include "tokenizer.hh"
 #include "value.hh"
 #include "config.hh"
 
@@ -58,7 +63,7 @@ private:
     Value value;
 };
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(bool canAssign);
 
 typedef struct {
     ParseFn prefix;
@@ -73,24 +78,52 @@ typedef struct Parser {
     bool panicMode;
 } Parser;
 
-Parser parser;
-Chunk *compilingChunk;
+// Compiler state is per thread so server workers can compile concurrently.
+thread_local Parser parser;
+thread_local Chunk *compilingChunk;
+// Set while compiling a source that was tokenized up front; otherwise tokens come from the scanner.
+static thread_local TokenBuffer *tokenBuffer;
+// Where this compilation's code begins; a session appends to code compiled earlier.
+static thread_local int32_t codeStart;
 
-static void unary();
+// Variables a block declares; each owns the stack slot its initializer left its value in.
+typedef struct {
+    Token name;
+    // Depth of the declaring block, or -1 while the initializer is compiled.
+    int32_t depth;
+    uint8_t slot;
+} Local;
+
+// Slots are one-byte operands.
+#define MAX_LOCALS (UINT8_MAX + 1)
+
+static thread_local Local locals[MAX_LOCALS];
+static thread_local int32_t localCount;
+static thread_local int32_t scopeDepth;
+// Values the code compiled so far leaves on the stack, which is the slot the next one lands in.
+static thread_local int32_t stackDepth;
+
+static void unary(bool canAssign);
+
+static void binary(bool canAssign);
 
-static void binary();
+static void call(bool canAssign);
+
+static void variable(bool canAssign);
+
+static void block(bool canAssign);
 
 static void expression();
 
 static void advance();
 
-static void number();
+static void number(bool canAssign);
 
-static void grouping();
+static void grouping(bool canAssign);
 
-static void literal();
+static void literal(bool canAssign);
 
-static void string();
+static void string(bool canAssign);
 
 static void consume(TokenType type, const char *message);
 
@@ -106,12 +139,14 @@ static void emitConstant(Value value);
 
 static void endCompiler();
 
-static uint8_t makeConstant(Value value);
+static int32_t makeConstant(Value value);
 
-static ParseRule *getRule(TokenType type);
+static const ParseRule *getRule(TokenType type);
 
 static void parsePrecedence(Precedence precedence);
 
+static void infixOperators(Precedence precedence);
+
 static Chunk *currentChunk();
 
 static void errorAt(Token *token, const char *message);
@@ -120,49 +155,35 @@ static void error(const char *message);
 
 static void errorAtCurrent(const char *message);
 
-std::unordered_map<TokenType, ParseRule> rules{
-        {TokenType::LEFT_PAREN,    {grouping, nullptr, Precedence::NONE}},
-        {TokenType::RIGHT_PAREN,   {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::LEFT_BRACE,    {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::RIGHT_BRACE,   {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::COMMA,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::DOT,           {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::MINUS,         {unary,    binary,  Precedence::TERM}},
-        {TokenType::PLUS,          {nullptr,  binary,  Precedence::TERM}},
-        {TokenType::SEMICOLON,     {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::SLASH,         {nullptr,  binary,  Precedence::FACTOR}},
-        {TokenType::STAR,          {nullptr,  binary,  Precedence::FACTOR}},
-        {TokenType::BANG,          {unary,    nullptr, Precedence::NONE}},
-        {TokenType::BANG_EQUAL,    {nullptr,  binary,  Precedence::EQUALITY}},
-        {TokenType::EQUAL,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::EQUAL_EQUAL,   {nullptr,  binary,  Precedence::EQUALITY}},
-        {TokenType::GREATER,       {nullptr,  binary,  Precedence::COMPARISON}},
-        {TokenType::GREATER_EQUAL, {nullptr,  binary,  Precedence::COMPARISON}},
-        {TokenType::LESS,          {nullptr,  binary,  Precedence::COMPARISON}},
-        {TokenType::LESS_EQUAL,    {nullptr,  binary,  Precedence::COMPARISON}},
-        {TokenType::IDENTIFIER,    {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::STRING,        {string,   nullptr, Precedence::NONE}},
-        {TokenType::NUMBER,        {number,   nullptr, Precedence::NONE}},
-        {TokenType::AND,           {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::CLASS,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::ELSE,          {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::FALSE,         {literal,  nullptr, Precedence::NONE}},
-        {TokenType::FOR,           {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::FUN,           {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::IF,            {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::NIL,           {literal,  nullptr, Precedence::NONE}},
-        {TokenType::OR,            {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::PRINT,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::RETURN,        {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::SUPER,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::THIS,          {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::TRUE,          {literal,  nullptr, Precedence::NONE}},
-        {TokenType::VAR,           {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::WHILE,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::ERROR,         {nullptr,  nullptr, Precedence::NONE}},
-        {TokenType::TOKEN_EOF,     {nullptr,  nullptr, Precedence::NONE}},
-};
+// Built at compile time as a dense array indexed by TokenType; tokens not listed have no rule.
+static constexpr std::array<ParseRule, TOKEN_COUNT> makeRules() {
+    std::array<ParseRule, TOKEN_COUNT> rules{};
+    auto rule = [&rules](TokenType type, ParseFn prefix, ParseFn infix, Precedence precedence) {
+        rules[static_cast<size_t>(type)] = {prefix, infix, precedence};
+    };
+    rule(TokenType::LEFT_PAREN,    grouping, call,    Precedence::CALL);
+    rule(TokenType::LEFT_BRACE,    block,    nullptr, Precedence::NONE);
+    rule(TokenType::MINUS,         unary,    binary,  Precedence::TERM);
+    rule(TokenType::PLUS,          nullptr,  binary,  Precedence::TERM);
+    rule(TokenType::SLASH,         nullptr,  binary,  Precedence::FACTOR);
+    rule(TokenType::STAR,          nullptr,  binary,  Precedence::FACTOR);
+    rule(TokenType::BANG,          unary,    nullptr, Precedence::NONE);
+    rule(TokenType::BANG_EQUAL,    nullptr,  binary,  Precedence::EQUALITY);
+    rule(TokenType::EQUAL_EQUAL,   nullptr,  binary,  Precedence::EQUALITY);
+    rule(TokenType::GREATER,       nullptr,  binary,  Precedence::COMPARISON);
+    rule(TokenType::GREATER_EQUAL, nullptr,  binary,  Precedence::COMPARISON);
+    rule(TokenType::LESS,          nullptr,  binary,  Precedence::COMPARISON);
+    rule(TokenType::LESS_EQUAL,    nullptr,  binary,  Precedence::COMPARISON);
+    rule(TokenType::IDENTIFIER,    variable, nullptr, Precedence::NONE);
+    rule(TokenType::STRING,        string,   nullptr, Precedence::NONE);
+    rule(TokenType::NUMBER,        number,   nullptr, Precedence::NONE);
+    rule(TokenType::FALSE,         literal,  nullptr, Precedence::NONE);
+    rule(TokenType::NIL,           literal,  nullptr, Precedence::NONE);
+    rule(TokenType::TRUE,          literal,  nullptr, Precedence::NONE);
+    return rules;
+}
 
+static constexpr std::array<ParseRule, TOKEN_COUNT> rules = makeRules();
 
 static Chunk *currentChunk() {
     return compilingChunk;
@@ -196,7 +217,7 @@ static void advance() {
     parser.previous = parser.current;
 
     for (;;) {
-        parser.current = scanToken();
+        parser.current = tokenBuffer != nullptr ? nextToken(tokenBuffer) : scanToken();
         if (parser.current.type != TokenType::ERROR) break;
         errorAtCurrent(parser.current.start);
     }
@@ -210,23 +231,33 @@ static void consume(TokenType type, const char *message) {
     errorAtCurrent(message);
 }
 
-static uint8_t makeConstant(Value value) {
+static bool match(TokenType type) {
+    if (parser.current.type != type) return false;
+    advance();
+    return true;
+}
+
+static int32_t makeConstant(Value value) {
     int32_t constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) {
+    if (constant < 0) {
+        error("Out of memory.");
+        return 0;
+    }
+    if (constant >= MAX_CONSTANTS) {
         error("Too many constants in one chunk.");
         return 0;
     }
-    return (uint8_t) constant;
+    return constant;
 }
 
 template<typename T>
 static void emitBytes(T byte) {
-    writeChunk(currentChunk(), static_cast<uint8_t>(byte), parser.previous.line);
+    if (!writeChunk(currentChunk(), static_cast<uint8_t>(byte), parser.previous.line)) error("Out of memory.");
 }
 
 template<typename T, typename... Args>
 static void emitBytes(T byte, Args... bytes) {
-    writeChunk(currentChunk(), static_cast<uint8_t>(byte), parser.previous.line);
+    emitBytes(byte);
     emitBytes(bytes...);
 }
 
@@ -234,15 +265,27 @@ static void emitReturn() {
     emitBytes(OpCode::RETURN);
 }
 
+// Every value the code pushes goes through here, so no run can outgrow VM::stack; that covers
+// call arguments, operands waiting on nested expressions and block locals alike.
+static void growStack() {
+    if (++stackDepth > STACK_MAX) error("Too much stack.");
+}
+
 static void emitConstant(Value value) {
-    emitBytes(OpCode::CONSTANT, makeConstant(value));
+    growStack();
+    int32_t constant = makeConstant(value);
+    if (constant <= UINT8_MAX) {
+        emitBytes(OpCode::CONSTANT, constant);
+    } else {
+        emitBytes(OpCode::CONSTANT_LONG, constant & 0xFF, (constant >> 8) & 0xFF, (constant >> 16) & 0xFF);
+    }
 }
 
 static void endCompiler() {
     emitReturn();
 #if defined(DEBUG_PRINT_CODE)
     if (!parser.hadError) {
-        disassembleChunk(currentChunk(), "code");
+        disassembleChunk(currentChunk(), "code", codeStart);
     }
 #endif
 }
@@ -255,12 +298,20 @@ static void parsePrecedence(Precedence precedence) {
         return;
     }
 
-    prefixRule();
+    bool canAssign = precedence <= Precedence::ASSIGNMENT;
+    prefixRule(canAssign);
+    infixOperators(precedence);
+
+    if (canAssign && match(TokenType::EQUAL)) error("Invalid assignment target.");
+}
 
+// Applies the operators that follow to whatever the code so far leaves on the stack.
+static void infixOperators(Precedence precedence) {
+    bool canAssign = precedence <= Precedence::ASSIGNMENT;
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+        infixRule(canAssign);
     }
 }
 
@@ -268,17 +319,31 @@ static void expression() {
     parsePrecedence(Precedence::ASSIGNMENT);
 }
 
-static void grouping() {
+static void grouping(bool) {
     expression();
     consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number() {
-    double value = strtod(parser.previous.start, nullptr);
-    emitConstant(Value(value));
+// Literals without a fraction are integers unless they do not fit in 64 bits.
+static void number(bool) {
+    const char *start = parser.previous.start;
+    const char *end = start + parser.previous.length;
+    if (memchr(start, '.', end - start) == nullptr) {
+        int64_t value = 0;
+        const char *digit = start;
+        while (digit < end && !__builtin_mul_overflow(value, 10, &value) &&
+               !__builtin_add_overflow(value, *digit - '0', &value)) {
+            digit++;
+        }
+        if (digit == end) {
+            emitConstant(Value(value));
+            return;
+        }
+    }
+    emitConstant(Value(parseDecimal(start, end)));
 }
 
-static void unary() {
+static void unary(bool) {
     TokenType operatorType = parser.previous.type;
     parsePrecedence(Precedence::UNARY);
 
@@ -294,7 +359,8 @@ static void unary() {
     }
 }
 
-static void literal() {
+static void literal(bool) {
+    growStack();
     switch (parser.previous.type) {
         case TokenType::FALSE:
             emitBytes(OpCode::FALSE);
@@ -310,10 +376,11 @@ static void literal() {
     }
 }
 
-static void binary() {
+static void binary(bool) {
     TokenType operatorType = parser.previous.type;
-    ParseRule *rule = getRule(operatorType);
+    const ParseRule *rule = getRule(operatorType);
     parsePrecedence((Precedence) (rule->precedence + 1));
+    stackDepth--;
     switch (operatorType) {
         case TokenType::PLUS:
             emitBytes(OpCode::ADD);
@@ -337,38 +404,221 @@ static void binary() {
             emitBytes(OpCode::GREATER);
             break;
         case TokenType::GREATER_EQUAL:
-            emitBytes(OpCode::LESS, OpCode::NOT);
+            emitBytes(OpCode::GREATER_EQUAL);
             break;
         case TokenType::LESS:
             emitBytes(OpCode::LESS);
             break;
         case TokenType::LESS_EQUAL:
-            emitBytes(OpCode::GREATER, OpCode::NOT);
+            emitBytes(OpCode::LESS_EQUAL);
             break;
         default:
             return;
     }
 }
 
-[[gnu::unused]]
-static void string() {
-    emitConstant(Value(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+static void call(bool) {
+    int argCount = 0;
+    if (parser.current.type != TokenType::RIGHT_PAREN) {
+        do {
+            expression();
+            if (argCount == MAX_ARGUMENTS) error("Can't have more than 255 arguments.");
+            argCount++;
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+    emitBytes(OpCode::CALL, argCount);
+    stackDepth -= argCount;
+}
+
+static int32_t globalSlotOf(const Token *name) {
+    ObjString *string = copyString(name->start, name->length);
+    int32_t slot = string != nullptr ? globalSlot(string) : -1;
+    if (slot < 0) {
+        error(string == nullptr || vm.globalCount < MAX_GLOBALS ? "Out of memory." : "Too many global variables.");
+        return 0;
+    }
+    return slot;
 }
 
-static ParseRule *getRule(TokenType type) {
-    return &rules[type];
+static void emitGlobal(OpCode opcode, int32_t slot) {
+    emitBytes(opcode, slot & 0xFF, (slot >> 8) & 0xFF);
+}
+
+static bool identifiersEqual(const Token *a, const Token *b) {
+    return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+// The innermost local with this name, or nullptr when it names a global.
+static Local *resolveLocal(const Token *name) {
+    for (int32_t i = localCount - 1; i >= 0; i--) {
+        Local *local = &locals[i];
+        if (identifiersEqual(&local->name, name)) {
+            if (local->depth == -1) error("Can't read local variable in its own initializer.");
+            return local;
+        }
+    }
+    return nullptr;
+}
+
+static void variable(bool canAssign) {
+    Local *local = resolveLocal(&parser.previous);
+    int32_t slot = local != nullptr ? local->slot : globalSlotOf(&parser.previous);
+    if (canAssign && match(TokenType::EQUAL)) {
+        expression();
+        if (local != nullptr) {
+            emitBytes(OpCode::SET_LOCAL, slot);
+        } else {
+            emitGlobal(OpCode::SET_GLOBAL, slot);
+        }
+    } else {
+        growStack();
+        if (local != nullptr) {
+            emitBytes(OpCode::GET_LOCAL, slot);
+        } else {
+            emitGlobal(OpCode::GET_GLOBAL, slot);
+        }
+    }
 }
 
-bool compile(const char *source, Chunk *chunk) {
-    initScanner(source);
+static void emitPop(int32_t count) {
+    stackDepth -= count;
+    if (count == 1) {
+        emitBytes(OpCode::POP);
+    } else {
+        emitBytes(OpCode::POPN, count);
+    }
+}
+
+static void emitNil() {
+    growStack();
+    emitBytes(OpCode::NIL);
+}
+
+static void string(bool) {
+    ObjString *string = copyString(parser.previous.start + 1, parser.previous.length - 2);
+    if (string == nullptr) {
+        error("Out of memory.");
+        return;
+    }
+    emitConstant(Value(string));
+}
+
+static const ParseRule *getRule(TokenType type) {
+    return &rules[static_cast<size_t>(type)];
+}
+
+static bool compileWith(const char *source, size_t length, Chunk *chunk, void (*body)()) {
+    TokenBuffer buffer;
+    if (tokenizeParallel(source, length, &buffer)) {
+        tokenBuffer = &buffer;
+    } else {
+        initScanner(source, length);
+    }
     compilingChunk = chunk;
+    codeStart = chunk->count;
+    localCount = 0;
+    scopeDepth = 0;
+    stackDepth = 0;
 
     parser.hadError = false;
     parser.panicMode = false;
 
     advance();
-    expression();
+    body();
     consume(TokenType::TOKEN_EOF, "Expect end of expression.");
     endCompiler();
+    if (tokenBuffer != nullptr) {
+        freeTokenBuffer(tokenBuffer);
+        tokenBuffer = nullptr;
+    }
     return !parser.hadError;
 }
+
+// Inside a block the variable is a local: the initializer's value stays where it is.
+static void varDeclaration() {
+    consume(TokenType::IDENTIFIER, "Expect variable name.");
+    Token name = parser.previous;
+    int32_t slot = 0;
+    if (scopeDepth > 0) {
+        for (int32_t i = localCount - 1; i >= 0 && locals[i].depth >= scopeDepth; i--) {
+            if (identifiersEqual(&locals[i].name, &name)) error("Already a variable with this name in this scope.");
+        }
+        if (localCount == MAX_LOCALS || stackDepth > UINT8_MAX) {
+            error("Too many local variables in scope.");
+        } else {
+            locals[localCount++] = {name, -1, static_cast<uint8_t>(stackDepth)};
+        }
+    } else {
+        slot = globalSlotOf(&name);
+    }
+    if (match(TokenType::EQUAL)) {
+        expression();
+    } else {
+        emitNil();
+    }
+    consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+    if (scopeDepth > 0) {
+        if (localCount > 0) locals[localCount - 1].depth = scopeDepth;
+    } else {
+        stackDepth--;
+        emitGlobal(OpCode::DEFINE_GLOBAL, slot);
+    }
+}
+
+// Declarations and expression statements up to `end`, optionally followed by an expression
+// without a semicolon whose value is left on the stack; returns whether there was one. A
+// block needs no semicolon to be a statement.
+static bool statements(TokenType end) {
+    while (!parser.panicMode && parser.current.type != end && parser.current.type != TokenType::TOKEN_EOF) {
+        if (match(TokenType::VAR)) {
+            varDeclaration();
+            continue;
+        }
+        expression();
+        if (match(TokenType::SEMICOLON)) {
+            emitPop(1);
+            continue;
+        }
+        if (parser.current.type == end || parser.previous.type != TokenType::RIGHT_BRACE) return true;
+        emitPop(1);
+    }
+    return false;
+}
+
+// A block evaluates to its final expression, or nil. Its locals are dropped at the end in one
+// POPN after the value moves down into the first of their slots.
+static void block(bool) {
+    int32_t base = stackDepth;
+    scopeDepth++;
+    if (!statements(TokenType::RIGHT_BRACE)) emitNil();
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+    scopeDepth--;
+
+    int32_t count = 0;
+    while (localCount > 0 && locals[localCount - 1].depth > scopeDepth) {
+        localCount--;
+        count++;
+    }
+    if (count > 0) {
+        emitBytes(OpCode::SET_LOCAL, base);
+        emitPop(count);
+    }
+}
+
+// A script evaluates to its final expression; one that ends in a statement evaluates to nil.
+static void script() {
+    if (!statements(TokenType::TOKEN_EOF)) emitNil();
+}
+
+bool compile(const char *source, size_t length, Chunk *chunk) {
+    return compileWith(source, length, chunk, script);
+}
+
+bool compileStage(const char *source, size_t length, Chunk *chunk) {
+    return compileWith(source, length, chunk, [] {
+        // The message is already in slot 0.
+        stackDepth = 1;
+        infixOperators(Precedence::ASSIGNMENT);
+    });
+}
@@ -4,6 +4,18 @@
 
 #include <cstdio>
 #include "debug.hh"
+#include "vm.hh"
+
+// Disassembly is written with stdio rather than the VM's output, which it would overtake.
+static void printConstant(const Value &value) {
+    if (value.isString()) {
+        printf("%.*s", value.asString()->length, value.asString()->chars);
+    } else {
+        char text[DOUBLE_BUFFER_SIZE];
+        value.format(text, sizeof(text));
+        printf("%s", text);
+    }
+}
 
 int32_t simpleInstruction(const char *name, int32_t offset) {
     printf("%s\n", name);
@@ -13,18 +25,97 @@ int32_t simpleInstruction(const char *name, int32_t offset) {
 int32_t constantInstruction(const char *name, Chunk *chunk, int32_t offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
-    chunk->constants.values[constant].print();
+    printConstant(chunk->constants.values[constant]);
     printf("'\n");
     return offset + 2;
 }
 
-void disassembleChunk(Chunk *chunk, const char *name) {
+int32_t constantLongInstruction(const char *name, Chunk *chunk, int32_t offset) {
+    uint32_t constant = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+    printf("%-16s %4u '", name, constant);
+    printConstant(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+int32_t byteInstruction(const char *name, Chunk *chunk, int32_t offset) {
+    printf("%-16s %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+// Slots are only meaningful to the VM that compiled the chunk, which is this thread's.
+int32_t globalInstruction(const char *name, Chunk *chunk, int32_t offset) {
+    uint16_t slot = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+    printf("%-16s %4u", name, slot);
+    if (slot < vm.globalCount) printf(" '%s'", vm.globals[slot].name->chars);
+    printf("\n");
+    return offset + 3;
+}
+
+void disassembleChunk(Chunk *chunk, const char *name, int32_t start) {
     printf("== %s ==\n", name);
-    for (int32_t offset = 0; offset < chunk->count;) {
+    for (int32_t offset = start; offset < chunk->count;) {
         offset = disassembleInstruction(chunk, offset);
     }
 }
 
+const char *opcodeName(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::RETURN:
+            return "RETURN";
+        case OpCode::NEGATE:
+            return "NEGATE";
+        case OpCode::ADD:
+            return "ADD";
+        case OpCode::SUBTRACT:
+            return "SUBTRACT";
+        case OpCode::MULTIPLY:
+            return "MULTIPLY";
+        case OpCode::DIVIDE:
+            return "DIVIDE";
+        case OpCode::CONSTANT:
+            return "CONSTANT";
+        case OpCode::CONSTANT_LONG:
+            return "CONSTANT_LONG";
+        case OpCode::NIL:
+            return "NIL";
+        case OpCode::TRUE:
+            return "TRUE";
+        case OpCode::FALSE:
+            return "FALSE";
+        case OpCode::NOT:
+            return "NOT";
+        case OpCode::EQUAL:
+            return "EQUAL";
+        case OpCode::GREATER:
+            return "GREATER";
+        case OpCode::LESS:
+            return "LESS";
+        case OpCode::GREATER_EQUAL:
+            return "GREATER_EQUAL";
+        case OpCode::LESS_EQUAL:
+            return "LESS_EQUAL";
+        case OpCode::CALL:
+            return "CALL";
+        case OpCode::POP:
+            return "POP";
+        case OpCode::DEFINE_GLOBAL:
+            return "DEFINE_GLOBAL";
+        case OpCode::GET_GLOBAL:
+            return "GET_GLOBAL";
+        case OpCode::SET_GLOBAL:
+            return "SET_GLOBAL";
+        case OpCode::GET_LOCAL:
+            return "GET_LOCAL";
+        case OpCode::SET_LOCAL:
+            return "SET_LOCAL";
+        case OpCode::POPN:
+            return "POPN";
+        default:
+            return nullptr;
+    }
+}
+
 int32_t disassembleInstruction(Chunk *chunk, int32_t offset) {
     printf("%04d ", offset);
     if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
@@ -35,36 +126,37 @@ int32_t disassembleInstruction(Chunk *chunk, int32_t offset) {
     auto instruction = static_cast<OpCode>(chunk->code[offset]);
     switch (instruction) {
         case OpCode::RETURN:
-            return simpleInstruction("RETURN", offset);
         case OpCode::ADD:
-            return simpleInstruction("ADD", offset);
         case OpCode::SUBTRACT:
-            return simpleInstruction("SUBTRACT", offset);
         case OpCode::MULTIPLY:
-            return simpleInstruction("MULTIPLY", offset);
         case OpCode::DIVIDE:
-            return simpleInstruction("DIVIDE", offset);
         case OpCode::NEGATE:
-            return simpleInstruction("NEGATE", offset);
-        case OpCode::CONSTANT:
-            return constantInstruction("CONSTANT", chunk, offset);
         case OpCode::NIL:
-            return simpleInstruction("NIL", offset);
         case OpCode::TRUE:
-            return simpleInstruction("TRUE", offset);
         case OpCode::FALSE:
-            return simpleInstruction("FALSE", offset);
         case OpCode::NOT:
-            return simpleInstruction("NOT", offset);
         case OpCode::EQUAL:
-            return simpleInstruction("EQUAL", offset);
         case OpCode::GREATER:
-            return simpleInstruction("GREATER", offset);
         case OpCode::LESS:
-            return simpleInstruction("LESS", offset);
+        case OpCode::GREATER_EQUAL:
+        case OpCode::LESS_EQUAL:
+        case OpCode::POP:
+            return simpleInstruction(opcodeName(instruction), offset);
+        case OpCode::CONSTANT:
+            return constantInstruction(opcodeName(instruction), chunk, offset);
+        case OpCode::CONSTANT_LONG:
+            return constantLongInstruction(opcodeName(instruction), chunk, offset);
+        case OpCode::CALL:
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::POPN:
+            return byteInstruction(opcodeName(instruction), chunk, offset);
+        case OpCode::DEFINE_GLOBAL:
+        case OpCode::GET_GLOBAL:
+        case OpCode::SET_GLOBAL:
+            return globalInstruction(opcodeName(instruction), chunk, offset);
         default:
             printf("Unknown opcode %hhu\n", static_cast<uint8_t>(instruction));
             return offset + 1;
     }
 }
-
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstring>
+#include <latch>
+#include <thread>
+#include "isolate.hh"
+#include "compiler.hh"
+#include "memory.hh"
+#include "object.hh"
+#include "vm.hh"
+
+struct Isolate {
+    std::thread thread;
+    const char *source;
+    Channel *input;
+    Channel *output;
+    bool compiled;
+};
+
+// Compiles the stage into a fresh VM; the chunk's constants live in that VM's heap.
+static bool startIsolate(Isolate *isolate, Chunk *chunk) {
+    bool started = initVM();
+    if (!started) fprintf(stderr, "Out of memory.\n");
+    vm.captureResult = true;
+    initChunk(chunk);
+    return started && compileStage(isolate->source, strlen(isolate->source), chunk);
+}
+
+// Only once the next stage has copied out everything this one sent, so nothing points into
+// the heap any more.
+static bool restartIsolate(Isolate *isolate, Chunk *chunk) {
+    drainChannel(isolate->output);
+    freeChunk(chunk);
+    freeVM();
+    return startIsolate(isolate, chunk);
+}
+
+static void runIsolate(Pipeline *pipeline, Isolate *isolate, std::latch *ready) {
+    Chunk chunk;
+    isolate->compiled = startIsolate(isolate, &chunk);
+    ready->count_down();
+
+    Value message;
+    ReceiveResult received;
+    while ((received = receiveMessage(isolate->input, &message)) != ReceiveResult::CLOSED) {
+        if (!isolate->compiled || received == ReceiveResult::OUT_OF_MEMORY) {
+            if (received == ReceiveResult::OUT_OF_MEMORY) fprintf(stderr, "Out of memory.\n");
+            pipeline->errors++;
+            continue;
+        }
+        InterpretResult result = interpretStage(&chunk, message);
+        if (result == InterpretResult::OK && (vm.result.isMap() || vm.result.isNative())) {
+            fprintf(stderr, "A stage cannot pass on a map or a native.\n");
+            result = InterpretResult::RUNTIME_ERROR;
+        }
+        if (result == InterpretResult::OK) {
+            sendMessage(isolate->output, vm.result);
+        } else {
+            pipeline->errors++;
+        }
+        if (memoryStats().liveBytes > ISOLATE_HEAP_LIMIT) isolate->compiled = restartIsolate(isolate, &chunk);
+    }
+    closeChannel(isolate->output);
+
+    drainChannel(isolate->output);
+    freeChunk(&chunk);
+    freeVM();
+}
+
+bool initPipeline(Pipeline *pipeline, const PipelineStage *stages, uint32_t stageCount, uint32_t capacity) {
+    pipeline->stageCount = stageCount;
+    pipeline->channels = new Channel[stageCount + 1];
+    pipeline->isolateCount = 0;
+    initChannel(&pipeline->channels[0], capacity, 1);
+    for (uint32_t i = 0; i < stageCount; i++) {
+        initChannel(&pipeline->channels[i + 1], capacity, stages[i].isolates);
+        pipeline->isolateCount += stages[i].isolates;
+    }
+    pipeline->errors = 0;
+
+    pipeline->isolates = new Isolate[pipeline->isolateCount]();
+    std::latch ready(pipeline->isolateCount);
+    Isolate *isolate = pipeline->isolates;
+    for (uint32_t i = 0; i < stageCount; i++) {
+        for (uint32_t j = 0; j < stages[i].isolates; j++, isolate++) {
+            isolate->source = stages[i].source;
+            isolate->input = &pipeline->channels[i];
+            isolate->output = &pipeline->channels[i + 1];
+            isolate->thread = std::thread(runIsolate, pipeline, isolate, &ready);
+        }
+    }
+    ready.wait();
+
+    for (uint32_t i = 0; i < pipeline->isolateCount; i++) {
+        if (!pipeline->isolates[i].compiled) {
+            freePipeline(pipeline);
+            return false;
+        }
+    }
+    return true;
+}
+
+Channel *pipelineInput(Pipeline *pipeline) {
+    return &pipeline->channels[0];
+}
+
+Channel *pipelineOutput(Pipeline *pipeline) {
+    return &pipeline->channels[pipeline->stageCount];
+}
+
+void freePipeline(Pipeline *pipeline) {
+    if (pipelineInput(pipeline)->producers != 0) closeChannel(pipelineInput(pipeline));
+    Value discarded;
+    while (receiveMessage(pipelineOutput(pipeline), &discarded) != ReceiveResult::CLOSED) {}
+
+    for (uint32_t i = 0; i < pipeline->isolateCount; i++) pipeline->isolates[i].thread.join();
+    delete[] pipeline->isolates;
+    pipeline->isolates = nullptr;
+    pipeline->isolateCount = 0;
+    for (uint32_t i = 0; i <= pipeline->stageCount; i++) freeChannel(&pipeline->channels[i]);
+    delete[] pipeline->channels;
+    pipeline->channels = nullptr;
+}
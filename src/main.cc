@@ -1,71 +1,272 @@
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include "vm.hh"
+#include "memory.hh"
+#include "profiler.hh"
+#include "tracer.hh"
+#include "compiler.hh"
+#include "perf.hh"
+#include "tokenizer.hh"
+#include "server.hh"
 
 void repl();
 
 void runFile(const char *path);
 
+static int decodeTraceFile(const char *dumpPath, const char *scriptPath);
+
+static bool reportMemory = false;
+static MemoryStatsFormat memoryFormat = MemoryStatsFormat::TEXT;
+static OpProfileFormat opProfileFormat = OpProfileFormat::TEXT;
+static const char *profilePath = nullptr;
+static uint32_t traceEvents = 0;
+static const char *tracePath = "clox.trace";
+static const char *decodePath = nullptr;
+static const char *servePath = nullptr;
+static uint32_t serveWorkers = 0;
+static size_t memoryLimit = 0;
+static const char *snapshotPath = nullptr;
+// Mapped for as long as the VM may use the image's strings.
+static Snapshot snapshot;
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [--mem-stats[=json]] [--profile-ops[=json]] [--profile[=out.folded]] [--perf-stats]\n"
+                    "            [--trace[=events]] [--trace-out=path] [--jobs=threads] [--memory-limit=bytes]\n"
+                    "            [--snapshot=image] [path]\n"
+                    "       clox --decode-trace=dump path\n"
+                    "       clox --serve socket [--workers=threads] [--jobs=threads] [--memory-limit=bytes]\n");
+    exit(64);
+}
+
+static void reportAtExit() {
+    stopLineProfiler();
+    if (reportMemory) printMemoryStats(stderr, memoryFormat);
+    if (opProfilerEnabled) printOpProfile(stderr, opProfileFormat);
+    if (perfStatsEnabled) printPerfStats(stderr);
+}
+
 int main(int argc, const char *argv[]) {
-    initVM();
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--mem-stats") == 0 || strcmp(arg, "--mem-stats=text") == 0) {
+            reportMemory = true;
+            memoryFormat = MemoryStatsFormat::TEXT;
+        } else if (strcmp(arg, "--mem-stats=json") == 0) {
+            reportMemory = true;
+            memoryFormat = MemoryStatsFormat::JSON;
+        } else if (strcmp(arg, "--profile-ops") == 0 || strcmp(arg, "--profile-ops=text") == 0) {
+            enableOpProfiler();
+            opProfileFormat = OpProfileFormat::TEXT;
+        } else if (strcmp(arg, "--profile-ops=json") == 0) {
+            enableOpProfiler();
+            opProfileFormat = OpProfileFormat::JSON;
+        } else if (strcmp(arg, "--profile") == 0) {
+            profilePath = "clox.folded";
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            profilePath = arg + 10;
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            scanThreads = (uint32_t) strtoul(arg + 7, nullptr, 10);
+            if (scanThreads == 0) usage();
+        } else if (strcmp(arg, "--perf-stats") == 0) {
+            enablePerfStats();
+        } else if (strcmp(arg, "--trace") == 0) {
+            traceEvents = TRACE_DEFAULT_EVENTS;
+        } else if (strncmp(arg, "--trace=", 8) == 0) {
+            traceEvents = (uint32_t) strtoul(arg + 8, nullptr, 10);
+            if (traceEvents == 0) usage();
+        } else if (strncmp(arg, "--trace-out=", 12) == 0) {
+            tracePath = arg + 12;
+        } else if (strcmp(arg, "--serve") == 0) {
+            if (++i == argc) usage();
+            servePath = argv[i];
+        } else if (strncmp(arg, "--serve=", 8) == 0) {
+            servePath = arg + 8;
+        } else if (strncmp(arg, "--memory-limit=", 15) == 0) {
+            memoryLimit = strtoull(arg + 15, nullptr, 10);
+            if (memoryLimit == 0) usage();
+        } else if (strncmp(arg, "--workers=", 10) == 0) {
+            serveWorkers = (uint32_t) strtoul(arg + 10, nullptr, 10);
+            if (serveWorkers == 0) usage();
+        } else if (strncmp(arg, "--snapshot=", 11) == 0) {
+            snapshotPath = arg + 11;
+        } else if (strncmp(arg, "--decode-trace=", 15) == 0) {
+            decodePath = arg + 15;
+        } else if (strncmp(arg, "--", 2) == 0 || path != nullptr) {
+            usage();
+        } else {
+            path = arg;
+        }
+    }
+
+    if (decodePath != nullptr) {
+        if (path == nullptr) usage();
+        return decodeTraceFile(decodePath, path);
+    }
 
-    if (argc == 1) {
+    // The profilers and the tracer keep process-wide state that only one VM may write to.
+    if (servePath != nullptr) {
+        if (path != nullptr || snapshotPath != nullptr || reportMemory || opProfilerEnabled || profilePath != nullptr || perfStatsEnabled ||
+            traceEvents > 0) {
+            usage();
+        }
+        uint32_t workers = serveWorkers != 0 ? serveWorkers : std::max(1u, std::thread::hardware_concurrency());
+        return serve(servePath, workers, memoryLimit);
+    }
+    if (serveWorkers != 0 || (snapshotPath != nullptr && path == nullptr)) usage();
+
+    // Reports run from atexit so scripts that fail with exit(65)/exit(70) are still covered.
+    atexit(reportAtExit);
+    if (profilePath != nullptr && !startLineProfiler(profilePath, path == nullptr ? "repl" : path)) {
+        fprintf(stderr, "Could not start the sampling profiler.\n");
+    }
+    if (traceEvents > 0 && !enableTracer(traceEvents, tracePath)) {
+        fprintf(stderr, "Could not start the execution tracer.\n");
+    }
+    if (!initVM()) {
+        fprintf(stderr, "Out of memory.\n");
+        freeVM();
+        return 70;
+    }
+    vm.memory.limitBytes = memoryLimit;
+    initSnapshot(&snapshot);
+
+    if (path == nullptr) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        runFile(path);
     }
 
     freeVM();
+    freeSnapshot(&snapshot);
     return 0;
 }
 
-static char *readFile(const char *path) {
-    FILE *file = fopen(path, "rb");
-    if (file == nullptr) {
+// Script text as handed to the scanner: a read-only mapping of the file where possible,
+// so tokens point straight into the page cache. It is released only after the script ran.
+struct SourceFile {
+    const char *begin;
+    size_t length;
+    bool mapped;
+};
+
+// Pipes and other unmappable inputs are read into a heap buffer instead.
+static SourceFile readSource(int fd, const char *path) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *buffer = (char *) malloc(capacity);
+    for (;;) {
+        if (buffer == nullptr) {
+            fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+            exit(74);
+        }
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = (char *) realloc(buffer, capacity);
+            continue;
+        }
+        ssize_t bytesRead = read(fd, buffer + length, capacity - length);
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead < 0) {
+            fprintf(stderr, "Could not read file \"%s\".\n", path);
+            exit(74);
+        }
+        if (bytesRead == 0) break;
+        length += bytesRead;
+    }
+    return {buffer, length, false};
+}
+
+static SourceFile openSource(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
-
-    char *buffer = (char *) malloc(fileSize + 1);
-    if (buffer == nullptr) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    SourceFile source{};
+    struct stat info{};
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
+    if (mapping != MAP_FAILED) {
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        source = {(const char *) mapping, (size_t) info.st_size, true};
+    } else {
+        source = readSource(fd, path);
     }
-    buffer[bytesRead] = '\0';
+    close(fd);
+    return source;
+}
 
-    fclose(file);
-    return buffer;
+static void closeSource(SourceFile *source) {
+    if (source->mapped) {
+        munmap(const_cast<char *>(source->begin), source->length);
+    } else {
+        free(const_cast<char *>(source->begin));
+    }
 }
 
 void runFile(const char *path) {
-    char *source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    SourceFile source = openSource(path);
+    InterpretResult result = snapshotPath != nullptr
+                             ? interpretSnapshot(source.begin, source.length, snapshotPath, &snapshot)
+                             : interpret(source.begin, source.length);
+    closeSource(&source);
+    flushOutput();
 
     if (result == InterpretResult::COMPILE_ERROR) exit(65);
     if (result == InterpretResult::RUNTIME_ERROR) exit(70);
 }
 
 void repl() {
-    char line[1024];
+    Session session;
+    initSession(&session);
+    char *line = nullptr;
+    size_t capacity = 0;
     for (;;) {
-        std::cout << "> ";
-        if (!fgets(line, sizeof(line), stdin)) {
-            std::cout << std::endl;
+        writeOutput("> ", 2);
+        flushOutput();
+        ssize_t length = getline(&line, &capacity, stdin);
+        if (length < 0) {
+            writeOutput("\n", 1);
             break;
         }
 
-        interpret(line);
+        interpretSession(&session, line, length);
     }
+    free(line);
+    freeSession(&session);
+}
+
+static int decodeTraceFile(const char *dumpPath, const char *scriptPath) {
+    SourceFile source = openSource(scriptPath);
+    // Compiling interns strings and resolves global slots, both of which need a VM.
+    bool started = initVM();
+    Chunk chunk;
+    initChunk(&chunk);
+    bool compiled = started && compile(source.begin, source.length, &chunk);
+    int status = 0;
+    if (!started) {
+        fprintf(stderr, "Out of memory.\n");
+        status = 70;
+    } else if (!compiled) {
+        status = 65;
+    } else if (!decodeTrace(dumpPath, &chunk)) {
+        fprintf(stderr, "Could not read trace \"%s\".\n", dumpPath);
+        status = 74;
+    }
+    freeChunk(&chunk);
+    freeVM();
+    closeSource(&source);
+    return status;
 }
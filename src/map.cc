@@ -0,0 +1,222 @@
+#include <cstring>
+#include "map.hh"
+#include "memory.hh"
+
+// A group is as many control bytes as one compare covers. Masks have a set bit per matching
+// slot, MASK_SHIFT bits apart.
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define GROUP_WIDTH 16
+#define MASK_SHIFT 0
+typedef __m128i Group;
+
+static inline Group loadGroup(const uint8_t *control) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(control));
+}
+
+static inline uint32_t matchByte(Group group, uint8_t byte) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+}
+
+// Only the empty byte has its high bit set.
+static inline uint32_t matchEmpty(Group group) {
+    return (uint32_t) _mm_movemask_epi8(group);
+}
+
+#else
+
+// Eight control bytes in a word, compared with bit tricks; a mask bit is each byte's high bit.
+#define GROUP_WIDTH 8
+#define MASK_SHIFT 3
+typedef uint64_t Group;
+
+#define LOW_BITS 0x0101010101010101u
+#define HIGH_BITS 0x8080808080808080u
+
+static inline Group loadGroup(const uint8_t *control) {
+    Group group;
+    memcpy(&group, control, sizeof(group));
+    return group;
+}
+
+// May also report a byte above a real match, which the key comparison then rejects.
+static inline uint64_t matchByte(Group group, uint8_t byte) {
+    uint64_t difference = group ^ (LOW_BITS * byte);
+    return (difference - LOW_BITS) & ~difference & HIGH_BITS;
+}
+
+static inline uint64_t matchEmpty(Group group) {
+    return group & HIGH_BITS;
+}
+
+#endif
+
+#define CONTROL_EMPTY 0x80
+#define MAP_MIN_CAPACITY 16
+// Grows past 7/8 full; a probe stops at the first group with an empty slot.
+#define MAP_MAX_LOAD_EIGHTHS 7
+
+static inline uint32_t firstSlot(uint64_t mask) {
+    return (uint32_t) __builtin_ctzll(mask) >> MASK_SHIFT;
+}
+
+static uint32_t mixHash(uint64_t bits) {
+    return (uint32_t) ((bits * 0x9E3779B97F4A7C15u) >> 32);
+}
+
+// Equal keys hash alike: strings use the hash cached at interning, and doubles holding a whole
+// number hash like the integer.
+static uint32_t hashKey(Value key) {
+    switch (key.type) {
+        case ValueType::BOOL:
+            return mixHash(key.asBool() ? 1 : 2);
+        case ValueType::NIL:
+            return mixHash(3);
+        case ValueType::INTEGER:
+            return mixHash((uint64_t) key.asInteger());
+        case ValueType::NUMBER: {
+            double number = key.asNumber();
+            if (number >= -0x1p63 && number < 0x1p63 && (double) (int64_t) number == number) {
+                return mixHash((uint64_t) (int64_t) number);
+            }
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return mixHash(bits);
+        }
+        case ValueType::OBJECT:
+            if (key.isString()) return key.asString()->hash;
+            return mixHash((uintptr_t) key.asObject());
+    }
+    return 0;
+}
+
+// The high bits pick the first slot, the low seven are the control byte.
+static inline uint32_t homeSlot(const Map *map, uint32_t hash) {
+    return (hash >> 7) & (map->capacity - 1);
+}
+
+static inline uint8_t controlByte(uint32_t hash) {
+    return hash & 0x7F;
+}
+
+static size_t controlSize(int32_t capacity) {
+    return (capacity + GROUP_WIDTH - 1 + 7) & ~(size_t) 7;
+}
+
+static size_t storageSize(int32_t capacity) {
+    return controlSize(capacity) + sizeof(MapEntry) * capacity;
+}
+
+static void setControl(Map *map, uint32_t slot, uint8_t byte) {
+    map->control[slot] = byte;
+    if (slot < GROUP_WIDTH - 1) map->control[map->capacity + slot] = byte;
+}
+
+void initMap(Map *map) {
+    map->control = nullptr;
+    map->entries = nullptr;
+    map->count = 0;
+    map->capacity = 0;
+    map->sizeClass = 0;
+}
+
+void freeMap(Map *map) {
+    if (map->capacity > 0) freeSlot(map->control, storageSize(map->capacity), map->sizeClass, MemoryCategory::TABLES);
+    initMap(map);
+}
+
+// Groups are read from the home slot on, one after another; entries only ever sit after a
+// run of full slots from their home, so the first group with an empty slot ends the search.
+static int32_t findSlot(const Map *map, Value key, uint32_t hash) {
+    if (map->capacity == 0) return -1;
+    uint32_t mask = map->capacity - 1;
+    uint32_t position = homeSlot(map, hash);
+    uint8_t byte = controlByte(hash);
+    for (;;) {
+        Group group = loadGroup(map->control + position);
+        for (auto matches = matchByte(group, byte); matches != 0; matches &= matches - 1) {
+            uint32_t slot = (position + firstSlot(matches)) & mask;
+            if (map->entries[slot].key == key) return (int32_t) slot;
+        }
+        if (matchEmpty(group) != 0) return -1;
+        position = (position + GROUP_WIDTH) & mask;
+    }
+}
+
+static uint32_t findEmpty(const Map *map, uint32_t hash) {
+    uint32_t mask = map->capacity - 1;
+    uint32_t position = homeSlot(map, hash);
+    for (;;) {
+        auto empties = matchEmpty(loadGroup(map->control + position));
+        if (empties != 0) return (position + firstSlot(empties)) & mask;
+        position = (position + GROUP_WIDTH) & mask;
+    }
+}
+
+static bool resize(Map *map, int32_t capacity) {
+    uint8_t sizeClass;
+    auto storage = (uint8_t *) allocateSlot(storageSize(capacity), MemoryCategory::TABLES, &sizeClass);
+    if (storage == nullptr) return false;
+    Map grown{storage, (MapEntry *) (storage + controlSize(capacity)), 0, capacity, sizeClass};
+    memset(grown.control, CONTROL_EMPTY, capacity + GROUP_WIDTH - 1);
+
+    for (int32_t i = 0; i < map->capacity; i++) {
+        if (map->control[i] == CONTROL_EMPTY) continue;
+        uint32_t hash = hashKey(map->entries[i].key);
+        uint32_t slot = findEmpty(&grown, hash);
+        setControl(&grown, slot, controlByte(hash));
+        grown.entries[slot] = map->entries[i];
+        grown.count++;
+    }
+    freeMap(map);
+    *map = grown;
+    return true;
+}
+
+bool mapGet(const Map *map, Value key, Value *value) {
+    int32_t slot = findSlot(map, key, hashKey(key));
+    if (slot < 0) return false;
+    *value = map->entries[slot].value;
+    return true;
+}
+
+bool mapSet(Map *map, Value key, Value value) {
+    uint32_t hash = hashKey(key);
+    int32_t slot = findSlot(map, key, hash);
+    if (slot >= 0) {
+        map->entries[slot].value = value;
+        return true;
+    }
+    if ((int64_t) (map->count + 1) * 8 > (int64_t) map->capacity * MAP_MAX_LOAD_EIGHTHS) {
+        if (map->capacity > INT32_MAX / 2) return false;
+        if (!resize(map, map->capacity < MAP_MIN_CAPACITY ? MAP_MIN_CAPACITY : map->capacity * 2)) return false;
+    }
+    uint32_t empty = findEmpty(map, hash);
+    setControl(map, empty, controlByte(hash));
+    map->entries[empty] = {key, value};
+    map->count++;
+    return true;
+}
+
+// Moves every later entry of the run that may live earlier into the hole, the way deletion
+// works for linear probing, so no slot is ever marked deleted.
+bool mapDelete(Map *map, Value key) {
+    int32_t slot = findSlot(map, key, hashKey(key));
+    if (slot < 0) return false;
+    uint32_t mask = map->capacity - 1;
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; map->control[next] != CONTROL_EMPTY; next = (next + 1) & mask) {
+        uint32_t home = homeSlot(map, hashKey(map->entries[next].key));
+        // It has to stay when its home lies after the hole.
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            map->entries[hole] = map->entries[next];
+            setControl(map, hole, map->control[next]);
+            hole = next;
+        }
+    }
+    setControl(map, hole, CONTROL_EMPTY);
+    map->count--;
+    return true;
+}
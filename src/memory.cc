@@ -2,17 +2,325 @@
 // Created by Sergei Lukaushkin on 17.06.2023.
 //
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdlib>
+#include <sys/mman.h>
 #include "memory.hh"
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
-    (void) oldSize; // TODO: remove and implement
+static constexpr size_t sizeClasses[] = {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+
+static constexpr size_t SIZE_CLASS_COUNT = sizeof(sizeClasses) / sizeof(sizeClasses[0]);
+static constexpr size_t MAX_SLOT_SIZE = sizeClasses[SIZE_CLASS_COUNT - 1];
+static constexpr size_t SLOT_ALIGNMENT = 8;
+
+// Maps every 8-byte step up to MAX_SLOT_SIZE to the smallest class that fits it.
+static constexpr auto sizeClassTable = [] {
+    std::array<uint8_t, MAX_SLOT_SIZE / SLOT_ALIGNMENT + 1> table{};
+    uint8_t sizeClass = 0;
+    for (size_t step = 0; step < table.size(); step++) {
+        while (sizeClasses[sizeClass] < step * SLOT_ALIGNMENT) sizeClass++;
+        table[step] = sizeClass;
+    }
+    return table;
+}();
+
+struct FreeSlot {
+    FreeSlot *next;
+};
+
+struct SlabChunk {
+    SlabChunk *next;
+};
+
+// Precedes objects too big for a size class so freeSlabs() can release them with the slabs.
+struct LargeSlot {
+    LargeSlot *next;
+    LargeSlot *previous;
+    size_t size;
+    MemoryCategory category;
+};
+
+struct SlabCache {
+    FreeSlot *freeLists[SIZE_CLASS_COUNT];
+    char *bump;
+    char *bumpEnd;
+    SlabChunk *chunks;
+    LargeSlot *large;
+    // Slots still handed out per category, released in bulk by freeSlabs().
+    size_t liveBytes[static_cast<size_t>(MemoryCategory::COUNT)];
+    size_t liveSlots[static_cast<size_t>(MemoryCategory::COUNT)];
+};
+
+static thread_local SlabCache slabs;
+
+// Per thread like the slabs; in server mode every worker accounts for its own heap.
+static thread_local MemoryStats stats;
+
+static thread_local MemoryQuota *quota;
+
+void setMemoryQuota(MemoryQuota *active) {
+    quota = active;
+}
+
+MemoryQuota *memoryQuota() {
+    return quota;
+}
+
+// Charges growth to the active quota, refusing it past the limit; credits shrinking.
+static bool chargeQuota(size_t oldSize, size_t newSize) {
+    if (quota == nullptr) return true;
+    if (newSize <= oldSize) {
+        quota->usedBytes -= std::min(quota->usedBytes, oldSize - newSize);
+        return true;
+    }
+    size_t used = quota->usedBytes + (newSize - oldSize);
+    if (quota->limitBytes != 0 && used > quota->limitBytes) return false;
+    quota->usedBytes = used;
+    if (used > quota->peakBytes) quota->peakBytes = used;
+    return true;
+}
+
+static void recordResize(MemoryCategory category, size_t oldSize, size_t newSize) {
+    MemoryCategoryStats &entry = stats.categories[static_cast<size_t>(category)];
     if (newSize == 0) {
+        entry.frees++;
+    } else {
+        if (oldSize == 0) entry.allocations++; else entry.reallocations++;
+        size_t bucket = std::bit_width(newSize - 1);
+        entry.histogram[bucket < MEMORY_HISTOGRAM_BUCKETS ? bucket : MEMORY_HISTOGRAM_BUCKETS - 1]++;
+    }
+
+    if (newSize > oldSize) {
+        size_t grown = newSize - oldSize;
+        entry.allocatedBytes += grown;
+        entry.liveBytes += grown;
+        stats.liveBytes += grown;
+        if (entry.liveBytes > entry.peakBytes) entry.peakBytes = entry.liveBytes;
+        if (stats.liveBytes > stats.peakBytes) stats.peakBytes = stats.liveBytes;
+    } else {
+        size_t shrunk = oldSize - newSize;
+        entry.liveBytes -= shrunk;
+        stats.liveBytes -= shrunk;
+    }
+}
+
+void *reallocate(void *pointer, size_t oldSize, size_t newSize, MemoryCategory category) {
+    if (newSize == 0) {
+        if (oldSize != 0) recordResize(category, oldSize, newSize);
+        chargeQuota(oldSize, newSize);
         free(pointer);
         return nullptr;
     }
 
+    if (!chargeQuota(oldSize, newSize)) return nullptr;
     void *result = realloc(pointer, newSize);
-    if (result == nullptr) exit(1);
+    if (result == nullptr) {
+        chargeQuota(newSize, oldSize);
+        return nullptr;
+    }
+    recordResize(category, oldSize, newSize);
     return result;
 }
+
+bool adoptAllocation(size_t size, MemoryCategory category) {
+    if (size == 0) return true;
+    recordResize(category, 0, size);
+    if (quota == nullptr) return true;
+    quota->usedBytes += size;
+    if (quota->usedBytes > quota->peakBytes) quota->peakBytes = quota->usedBytes;
+    return quota->limitBytes == 0 || quota->usedBytes <= quota->limitBytes;
+}
+
+static SlabChunk *mapChunk() {
+    // Over-map so the chunk can be aligned to its own size, which huge pages require.
+    size_t mappedSize = SLAB_CHUNK_SIZE * 2;
+    void *mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) return nullptr;
+
+    auto start = reinterpret_cast<uintptr_t>(mapped);
+    uintptr_t aligned = (start + SLAB_CHUNK_SIZE - 1) & ~(uintptr_t) (SLAB_CHUNK_SIZE - 1);
+    size_t head = aligned - start;
+    size_t tail = mappedSize - head - SLAB_CHUNK_SIZE;
+    if (head > 0) munmap(mapped, head);
+    if (tail > 0) munmap(reinterpret_cast<void *>(aligned + SLAB_CHUNK_SIZE), tail);
+
+    auto chunk = reinterpret_cast<SlabChunk *>(aligned);
+#if defined(MADV_HUGEPAGE)
+    madvise(chunk, SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    return chunk;
+}
+
+static void *bumpSlot(size_t slotSize) {
+    if (slabs.bump == nullptr || (size_t) (slabs.bumpEnd - slabs.bump) < slotSize) {
+        SlabChunk *chunk = mapChunk();
+        if (chunk == nullptr) return nullptr;
+        chunk->next = slabs.chunks;
+        slabs.chunks = chunk;
+        slabs.bump = reinterpret_cast<char *>(chunk) + sizeof(SlabChunk);
+        slabs.bumpEnd = reinterpret_cast<char *>(chunk) + SLAB_CHUNK_SIZE;
+    }
+
+    void *slot = slabs.bump;
+    slabs.bump += slotSize;
+    return slot;
+}
+
+void *allocateSlot(size_t size, MemoryCategory category, uint8_t *sizeClass) {
+    if (size > MAX_SLOT_SIZE) {
+        *sizeClass = SIZE_CLASS_LARGE;
+        auto large = (LargeSlot *) reallocate(nullptr, 0, sizeof(LargeSlot) + size, category);
+        if (large == nullptr) return nullptr;
+        large->next = slabs.large;
+        large->previous = nullptr;
+        large->size = size;
+        large->category = category;
+        if (slabs.large != nullptr) slabs.large->previous = large;
+        slabs.large = large;
+        return large + 1;
+    }
+
+    uint8_t index = sizeClassTable[(size + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT];
+    *sizeClass = index;
+    if (!chargeQuota(0, sizeClasses[index])) return nullptr;
+
+    void *slot = slabs.freeLists[index];
+    if (slot != nullptr) {
+        slabs.freeLists[index] = slabs.freeLists[index]->next;
+    } else if ((slot = bumpSlot(sizeClasses[index])) == nullptr) {
+        chargeQuota(sizeClasses[index], 0);
+        return nullptr;
+    }
+    recordResize(category, 0, sizeClasses[index]);
+    slabs.liveBytes[static_cast<size_t>(category)] += sizeClasses[index];
+    slabs.liveSlots[static_cast<size_t>(category)]++;
+    return slot;
+}
+
+void freeSlot(void *slot, size_t size, uint8_t sizeClass, MemoryCategory category) {
+    if (sizeClass == SIZE_CLASS_LARGE) {
+        LargeSlot *large = static_cast<LargeSlot *>(slot) - 1;
+        if (large->previous != nullptr) large->previous->next = large->next; else slabs.large = large->next;
+        if (large->next != nullptr) large->next->previous = large->previous;
+        reallocate(large, sizeof(LargeSlot) + size, 0, category);
+        return;
+    }
+
+    recordResize(category, sizeClasses[sizeClass], 0);
+    chargeQuota(sizeClasses[sizeClass], 0);
+    slabs.liveBytes[static_cast<size_t>(category)] -= sizeClasses[sizeClass];
+    slabs.liveSlots[static_cast<size_t>(category)]--;
+
+    auto freed = static_cast<FreeSlot *>(slot);
+    freed->next = slabs.freeLists[sizeClass];
+    slabs.freeLists[sizeClass] = freed;
+}
+
+void freeSlabs() {
+    for (size_t category = 0; category < static_cast<size_t>(MemoryCategory::COUNT); category++) {
+        MemoryCategoryStats &entry = stats.categories[category];
+        entry.frees += slabs.liveSlots[category];
+        entry.liveBytes -= slabs.liveBytes[category];
+        stats.liveBytes -= slabs.liveBytes[category];
+    }
+
+    LargeSlot *large = slabs.large;
+    while (large != nullptr) {
+        LargeSlot *next = large->next;
+        reallocate(large, sizeof(LargeSlot) + large->size, 0, large->category);
+        large = next;
+    }
+
+    SlabChunk *chunk = slabs.chunks;
+    while (chunk != nullptr) {
+        SlabChunk *next = chunk->next;
+        munmap(chunk, SLAB_CHUNK_SIZE);
+        chunk = next;
+    }
+    slabs = SlabCache{};
+}
+
+const char *memoryCategoryName(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::CODE:
+            return "code";
+        case MemoryCategory::LINES:
+            return "lines";
+        case MemoryCategory::CONSTANTS:
+            return "constants";
+        case MemoryCategory::STRINGS:
+            return "strings";
+        case MemoryCategory::OBJECTS:
+            return "objects";
+        case MemoryCategory::TABLES:
+            return "tables";
+        case MemoryCategory::OTHER:
+            return "other";
+        default:
+            return "unknown";
+    }
+}
+
+const MemoryStats &memoryStats() {
+    return stats;
+}
+
+static void printHistogramText(FILE *out, const MemoryCategoryStats &entry) {
+    for (size_t bucket = 0; bucket < MEMORY_HISTOGRAM_BUCKETS; bucket++) {
+        if (entry.histogram[bucket] == 0) continue;
+        fprintf(out, "    %s%-10zu %zu\n", bucket == MEMORY_HISTOGRAM_BUCKETS - 1 ? "> " : "<=",
+                bucket == MEMORY_HISTOGRAM_BUCKETS - 1 ? (size_t) 1 << (bucket - 1) : (size_t) 1 << bucket,
+                entry.histogram[bucket]);
+    }
+}
+
+static void printMemoryStatsText(FILE *out) {
+    fprintf(out, "== memory ==\n");
+    fprintf(out, "%-10s %12s %12s %12s %10s %10s %10s\n",
+            "category", "live", "peak", "allocated", "allocs", "reallocs", "frees");
+    for (size_t category = 0; category < static_cast<size_t>(MemoryCategory::COUNT); category++) {
+        const MemoryCategoryStats &entry = stats.categories[category];
+        fprintf(out, "%-10s %12zu %12zu %12zu %10zu %10zu %10zu\n",
+                memoryCategoryName(static_cast<MemoryCategory>(category)),
+                entry.liveBytes, entry.peakBytes, entry.allocatedBytes,
+                entry.allocations, entry.reallocations, entry.frees);
+    }
+    fprintf(out, "%-10s %12zu %12zu\n", "total", stats.liveBytes, stats.peakBytes);
+
+    for (size_t category = 0; category < static_cast<size_t>(MemoryCategory::COUNT); category++) {
+        const MemoryCategoryStats &entry = stats.categories[category];
+        if (entry.allocations + entry.reallocations == 0) continue;
+        fprintf(out, "  %s sizes:\n", memoryCategoryName(static_cast<MemoryCategory>(category)));
+        printHistogramText(out, entry);
+    }
+}
+
+static void printMemoryStatsJson(FILE *out) {
+    fprintf(out, "{\"live\":%zu,\"peak\":%zu,\"categories\":{", stats.liveBytes, stats.peakBytes);
+    for (size_t category = 0; category < static_cast<size_t>(MemoryCategory::COUNT); category++) {
+        const MemoryCategoryStats &entry = stats.categories[category];
+        fprintf(out, "%s\"%s\":{\"live\":%zu,\"peak\":%zu,\"allocated\":%zu,"
+                     "\"allocations\":%zu,\"reallocations\":%zu,\"frees\":%zu,\"histogram\":[",
+                category == 0 ? "" : ",", memoryCategoryName(static_cast<MemoryCategory>(category)),
+                entry.liveBytes, entry.peakBytes, entry.allocatedBytes,
+                entry.allocations, entry.reallocations, entry.frees);
+        for (size_t bucket = 0; bucket < MEMORY_HISTOGRAM_BUCKETS; bucket++) {
+            fprintf(out, "%s%zu", bucket == 0 ? "" : ",", entry.histogram[bucket]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "}}\n");
+}
+
+void printMemoryStats(FILE *out, MemoryStatsFormat format) {
+    switch (format) {
+        case MemoryStatsFormat::TEXT:
+            printMemoryStatsText(out);
+            break;
+        case MemoryStatsFormat::JSON:
+            printMemoryStatsJson(out);
+            break;
+    }
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "native.hh"
+#include "array.hh"
+#include "map.hh"
+#include "vm.hh"
+
+// Bound before the function is filled in; nothing can call it until the caller returns.
+static ObjNative *registerNative(const char *name, NativeSignature signature, uint8_t arity) {
+    ObjString *string = copyString(name, (int) strlen(name));
+    if (string == nullptr) return nullptr;
+    ObjNative *native = allocateNative(string, signature, arity);
+    if (native == nullptr || defineGlobal(name, Value(native)) < 0) return nullptr;
+    return native;
+}
+
+bool defineNative(const char *name, double (*function)()) {
+    ObjNative *native = registerNative(name, NativeSignature::NUMBER_0, 0);
+    if (native == nullptr) return false;
+    native->function.number0 = function;
+    return true;
+}
+
+bool defineNative(const char *name, double (*function)(double)) {
+    ObjNative *native = registerNative(name, NativeSignature::NUMBER_1, 1);
+    if (native == nullptr) return false;
+    native->function.number1 = function;
+    return true;
+}
+
+bool defineNative(const char *name, double (*function)(double, double)) {
+    ObjNative *native = registerNative(name, NativeSignature::NUMBER_2, 2);
+    if (native == nullptr) return false;
+    native->function.number2 = function;
+    return true;
+}
+
+bool defineNative(const char *name, uint8_t arity, NativeFn function) {
+    ObjNative *native = registerNative(name, NativeSignature::VALUES, arity);
+    if (native == nullptr) return false;
+    native->function.values = function;
+    return true;
+}
+
+bool nativeError(const char *message) {
+    vm.nativeError = message;
+    return false;
+}
+
+static double clockNative() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double sqrtNative(double value) {
+    return std::sqrt(value);
+}
+
+static double floorNative(double value) {
+    return std::floor(value);
+}
+
+static double absNative(double value) {
+    return std::fabs(value);
+}
+
+static double powNative(double base, double exponent) {
+    return std::pow(base, exponent);
+}
+
+static double minNative(double a, double b) {
+    return std::fmin(a, b);
+}
+
+static double maxNative(double a, double b) {
+    return std::fmax(a, b);
+}
+
+// A whole number in [0, limit), as an array length or index.
+static bool toIndex(Value value, int64_t limit, int32_t *index) {
+    if (value.isInteger()) {
+        if (value.asInteger() < 0 || value.asInteger() >= limit) return false;
+        *index = (int32_t) value.asInteger();
+        return true;
+    }
+    if (!value.isDouble() || !(value.asNumber() >= 0 && value.asNumber() < (double) limit)) return false;
+    *index = (int32_t) value.asNumber();
+    return *index == value.asNumber();
+}
+
+// array(length, value): `length` elements, all `value`.
+static bool arrayNative(int, const Value *args, Value *result) {
+    int32_t count;
+    if (!toIndex(args[0], (int64_t) ARRAY_MAX_LENGTH + 1, &count) || !args[1].isNumber()) {
+        return nativeError("array expects a whole number length and a number.");
+    }
+    ObjArray *array = allocateArray(count);
+    if (array == nullptr) return nativeError("Out of memory.");
+    double value = args[1].asNumber();
+    std::fill(array->values, array->values + count, value);
+    *result = Value(array);
+    return true;
+}
+
+// range(length): 0, 1, ..., length - 1.
+static bool rangeNative(int, const Value *args, Value *result) {
+    int32_t count;
+    if (!toIndex(args[0], (int64_t) ARRAY_MAX_LENGTH + 1, &count)) {
+        return nativeError("range expects a whole number length.");
+    }
+    ObjArray *array = allocateArray(count);
+    if (array == nullptr) return nativeError("Out of memory.");
+    for (int32_t i = 0; i < count; i++) array->values[i] = i;
+    *result = Value(array);
+    return true;
+}
+
+static bool lengthNative(int, const Value *args, Value *result) {
+    if (args[0].isArray()) {
+        *result = Value((int64_t) args[0].asArray()->count);
+    } else if (args[0].isMap()) {
+        *result = Value((int64_t) args[0].asMap()->map.count);
+    } else {
+        return nativeError("length expects an array or a map.");
+    }
+    return true;
+}
+
+static bool atNative(int, const Value *args, Value *result) {
+    int32_t index;
+    if (!args[0].isArray()) return nativeError("at expects an array and an index.");
+    if (!toIndex(args[1], args[0].asArray()->count, &index)) return nativeError("Array index out of range.");
+    *result = Value(args[0].asArray()->values[index]);
+    return true;
+}
+
+static bool sumNative(int, const Value *args, Value *result) {
+    if (!args[0].isArray()) return nativeError("sum expects an array.");
+    *result = Value(arraySum(args[0].asArray()->values, args[0].asArray()->count));
+    return true;
+}
+
+static bool dotNative(int, const Value *args, Value *result) {
+    if (!args[0].isArray() || !args[1].isArray()) return nativeError("dot expects two arrays.");
+    if (args[0].asArray()->count != args[1].asArray()->count) return nativeError("Arrays must have the same length.");
+    *result = Value(arrayDot(args[0].asArray()->values, args[1].asArray()->values, args[0].asArray()->count));
+    return true;
+}
+
+// equalEach(a, b): 1 where the elements are equal and 0 elsewhere. Either side may be a
+// number compared with every element; `==` compares arrays by identity instead.
+static bool equalEachNative(int, const Value *args, Value *result) {
+    Value a = args[0];
+    Value b = args[1];
+    if (!(a.isArray() || a.isNumber()) || !(b.isArray() || b.isNumber()) || (a.isNumber() && b.isNumber())) {
+        return nativeError("equalEach expects two arrays, or an array and a number.");
+    }
+    if (a.isArray() && b.isArray() && a.asArray()->count != b.asArray()->count) {
+        return nativeError("Arrays must have the same length.");
+    }
+    int32_t count = a.isArray() ? a.asArray()->count : b.asArray()->count;
+    ObjArray *array = allocateArray(count);
+    if (array == nullptr) return nativeError("Out of memory.");
+    double scalarA = a.isNumber() ? a.asNumber() : 0;
+    double scalarB = b.isNumber() ? b.asNumber() : 0;
+    applyArrayOp(ArrayOp::EQUAL, a.isArray() ? a.asArray()->values : &scalarA, a.isNumber(),
+                 b.isArray() ? b.asArray()->values : &scalarB, b.isNumber(), array->values, count);
+    *result = Value(array);
+    return true;
+}
+
+static bool minOfNative(int, const Value *args, Value *result) {
+    if (!args[0].isArray()) return nativeError("minOf expects an array.");
+    *result = Value(arrayMin(args[0].asArray()->values, args[0].asArray()->count));
+    return true;
+}
+
+static bool maxOfNative(int, const Value *args, Value *result) {
+    if (!args[0].isArray()) return nativeError("maxOf expects an array.");
+    *result = Value(arrayMax(args[0].asArray()->values, args[0].asArray()->count));
+    return true;
+}
+
+static bool mapNative(int, const Value *, Value *result) {
+    ObjMap *map = allocateMap();
+    if (map == nullptr) return nativeError("Out of memory.");
+    *result = Value(map);
+    return true;
+}
+
+// get(map, key): the value, or nil when the key is missing.
+static bool getNative(int, const Value *args, Value *result) {
+    if (!args[0].isMap()) return nativeError("get expects a map and a key.");
+    if (!mapGet(&args[0].asMap()->map, args[1], result)) *result = Value();
+    return true;
+}
+
+// set(map, key, value) returns the value. NaN is refused as a key: it equals nothing, so it
+// could never be found again.
+static bool setNative(int, const Value *args, Value *result) {
+    if (!args[0].isMap()) return nativeError("set expects a map, a key and a value.");
+    if (args[1].isDouble() && std::isnan(args[1].asNumber())) return nativeError("A map key can't be NaN.");
+    if (!mapSet(&args[0].asMap()->map, args[1], args[2])) return nativeError("Out of memory.");
+    *result = args[2];
+    return true;
+}
+
+static bool hasNative(int, const Value *args, Value *result) {
+    Value value;
+    if (!args[0].isMap()) return nativeError("has expects a map and a key.");
+    *result = Value(mapGet(&args[0].asMap()->map, args[1], &value));
+    return true;
+}
+
+// remove(map, key) returns whether the key was there.
+static bool removeNative(int, const Value *args, Value *result) {
+    if (!args[0].isMap()) return nativeError("remove expects a map and a key.");
+    *result = Value(mapDelete(&args[0].asMap()->map, args[1]));
+    return true;
+}
+
+bool defineStandardNatives() {
+    return defineNative("clock", clockNative) &&
+           defineNative("sqrt", sqrtNative) &&
+           defineNative("floor", floorNative) &&
+           defineNative("abs", absNative) &&
+           defineNative("pow", powNative) &&
+           defineNative("min", minNative) &&
+           defineNative("max", maxNative) &&
+           defineNative("array", 2, arrayNative) &&
+           defineNative("range", 1, rangeNative) &&
+           defineNative("length", 1, lengthNative) &&
+           defineNative("at", 2, atNative) &&
+           defineNative("sum", 1, sumNative) &&
+           defineNative("dot", 2, dotNative) &&
+           defineNative("equalEach", 2, equalEachNative) &&
+           defineNative("minOf", 1, minOfNative) &&
+           defineNative("maxOf", 1, maxOfNative) &&
+           defineNative("map", 0, mapNative) &&
+           defineNative("get", 2, getNative) &&
+           defineNative("set", 3, setNative) &&
+           defineNative("has", 2, hasNative) &&
+           defineNative("remove", 2, removeNative);
+}
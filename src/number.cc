@@ -0,0 +1,491 @@
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "number.hh"
+
+typedef unsigned __int128 uint128_t;
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BIAS 1023
+#define DOUBLE_INFINITE_POWER 0x7FF
+
+// Decimal exponents the parser's table covers; anything beyond rounds to zero or infinity.
+#define SMALLEST_POWER_OF_TEN (-342)
+#define LARGEST_POWER_OF_TEN 308
+#define POWER_OF_TEN_COUNT (LARGEST_POWER_OF_TEN - SMALLEST_POWER_OF_TEN + 1)
+
+// Table sizes and precision of the shortest-digits printer, as in Ryu.
+#define POW5_INVERSE_COUNT 342
+#define POW5_COUNT 326
+#define POW5_BITCOUNT 125
+
+// 2^RECIPROCAL_BITS / 5^342 still has the 128 significant bits the parser table needs.
+#define RECIPROCAL_BITS 1760
+#define BIG_LIMBS (RECIPROCAL_BITS / 32 + 1)
+
+// Just enough of an arbitrary-precision integer to build the tables below at compile time.
+struct BigNumber {
+    uint32_t limbs[BIG_LIMBS]{};
+
+    constexpr int bitLength() const {
+        for (int i = BIG_LIMBS - 1; i >= 0; i--) {
+            if (limbs[i] != 0) return i * 32 + std::bit_width(limbs[i]);
+        }
+        return 0;
+    }
+
+    constexpr void multiplySmall(uint32_t factor) {
+        uint64_t carry = 0;
+        for (uint32_t &limb: limbs) {
+            uint64_t product = (uint64_t) limb * factor + carry;
+            limb = (uint32_t) product;
+            carry = product >> 32;
+        }
+    }
+
+    constexpr void divideSmall(uint32_t divisor) {
+        uint64_t remainder = 0;
+        for (int i = BIG_LIMBS - 1; i >= 0; i--) {
+            uint64_t current = remainder << 32 | limbs[i];
+            limbs[i] = (uint32_t) (current / divisor);
+            remainder = current % divisor;
+        }
+    }
+
+    constexpr void addOne() {
+        for (uint32_t &limb: limbs) {
+            if (++limb != 0) break;
+        }
+    }
+
+    // The value divided by 2^shift and rounded down; a negative shift multiplies.
+    constexpr BigNumber shifted(int shift) const {
+        BigNumber result;
+        for (int i = 0; i < BIG_LIMBS; i++) {
+            int bit = i * 32 + shift;
+            int word = bit >= 0 ? bit / 32 : (bit - 31) / 32;
+            int offset = bit - word * 32;
+            uint64_t low = word >= 0 && word < BIG_LIMBS ? limbs[word] : 0;
+            uint64_t high = word + 1 >= 0 && word + 1 < BIG_LIMBS ? limbs[word + 1] : 0;
+            result.limbs[i] = (uint32_t) ((high << 32 | low) >> offset);
+        }
+        return result;
+    }
+
+    constexpr uint64_t word(int index) const {
+        return (uint64_t) limbs[index * 2 + 1] << 32 | limbs[index * 2];
+    }
+};
+
+struct PowerTables {
+    // 5^q for every q, normalized to 128 bits, as {high, low}; negative powers rounded up.
+    uint64_t powersOfFive[POWER_OF_TEN_COUNT][2];
+    // Ryu's 2^(bits(5^i) - 1 + POW5_BITCOUNT) / 5^i + 1 and 5^i cut to POW5_BITCOUNT bits, as {low, high}.
+    uint64_t pow5Inverse[POW5_INVERSE_COUNT][2];
+    uint64_t pow5[POW5_COUNT][2];
+};
+
+// 5^k is built by multiplying and floor(2^RECIPROCAL_BITS / 5^k) by dividing by 5 step by step;
+// flooring twice is the same as flooring once, so every shift of the latter is exact too.
+static constexpr PowerTables makePowerTables() {
+    PowerTables tables{};
+    BigNumber power;
+    power.limbs[0] = 1;
+    BigNumber reciprocal;
+    reciprocal.limbs[BIG_LIMBS - 1] = 1u << (RECIPROCAL_BITS % 32);
+
+    for (int k = 0; k <= -SMALLEST_POWER_OF_TEN; k++) {
+        if (k > 0) {
+            power.multiplySmall(5);
+            reciprocal.divideSmall(5);
+        }
+        int length = power.bitLength();
+
+        if (k > 0) {
+            // 5^k is never a power of two, so its bit length is the least z with 2^z >= 5^k.
+            int bits = k <= 27 ? length + 127 : 2 * length + 128;
+            BigNumber inverse = reciprocal.shifted(RECIPROCAL_BITS - bits);
+            inverse.addOne();
+            int excess = inverse.bitLength() - 128;
+            if (excess > 0) inverse = inverse.shifted(excess);
+            tables.powersOfFive[-k - SMALLEST_POWER_OF_TEN][0] = inverse.word(1);
+            tables.powersOfFive[-k - SMALLEST_POWER_OF_TEN][1] = inverse.word(0);
+        }
+        if (k <= LARGEST_POWER_OF_TEN) {
+            BigNumber normalized = power.shifted(length - 128);
+            tables.powersOfFive[k - SMALLEST_POWER_OF_TEN][0] = normalized.word(1);
+            tables.powersOfFive[k - SMALLEST_POWER_OF_TEN][1] = normalized.word(0);
+        }
+        if (k < POW5_INVERSE_COUNT) {
+            BigNumber inverse = reciprocal.shifted(RECIPROCAL_BITS - (length - 1 + POW5_BITCOUNT));
+            inverse.addOne();
+            tables.pow5Inverse[k][0] = inverse.word(0);
+            tables.pow5Inverse[k][1] = inverse.word(1);
+        }
+        if (k < POW5_COUNT) {
+            BigNumber cut = power.shifted(length - POW5_BITCOUNT);
+            tables.pow5[k][0] = cut.word(0);
+            tables.pow5[k][1] = cut.word(1);
+        }
+    }
+    return tables;
+}
+
+static constexpr PowerTables powerTables = makePowerTables();
+
+static_assert(powerTables.powersOfFive[0][0] == 0xeef453d6923bd65au &&
+              powerTables.powersOfFive[0][1] == 0x113faa2906a13b3fu);
+static_assert(powerTables.powersOfFive[-SMALLEST_POWER_OF_TEN][0] == 1ull << 63);
+static_assert(powerTables.pow5Inverse[1][1] == 0x1999999999999999u &&
+              powerTables.pow5Inverse[1][0] == 0x999999999999999au);
+
+static constexpr double exactPowersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+struct BinaryFloat {
+    uint64_t mantissa;
+    int32_t power2;
+
+    bool operator==(const BinaryFloat &other) const = default;
+};
+
+static double toDouble(BinaryFloat value) {
+    return std::bit_cast<double>(value.mantissa | (uint64_t) value.power2 << DOUBLE_MANTISSA_BITS);
+}
+
+// w * 5^q to 55 significant bits; a second table word is only needed when those are all ones.
+static uint128_t productApproximation(int64_t q, uint64_t w) {
+    const uint64_t *power = powerTables.powersOfFive[q - SMALLEST_POWER_OF_TEN];
+    uint128_t first = (uint128_t) w * power[0];
+    const uint64_t precisionMask = UINT64_MAX >> (DOUBLE_MANTISSA_BITS + 3);
+    if (((uint64_t) (first >> 64) & precisionMask) == precisionMask) {
+        first += (uint64_t) (((uint128_t) w * power[1]) >> 64);
+    }
+    return first;
+}
+
+// Eisel and Lemire's algorithm, as in fast_float: the double nearest to w * 10^q for a w of at
+// most 19 digits, correct for every input without a slow path.
+static BinaryFloat eiselLemire(int64_t q, uint64_t w) {
+    if (w == 0 || q < SMALLEST_POWER_OF_TEN) return {0, 0};
+    if (q > LARGEST_POWER_OF_TEN) return {0, DOUBLE_INFINITE_POWER};
+
+    int leadingZeros = std::countl_zero(w);
+    w <<= leadingZeros;
+    uint128_t product = productApproximation(q, w);
+    auto high = (uint64_t) (product >> 64);
+    auto low = (uint64_t) product;
+
+    int upperBit = (int) (high >> 63);
+    int shift = upperBit + 64 - DOUBLE_MANTISSA_BITS - 3;
+    BinaryFloat answer{high >> shift, 0};
+    // floor(log2(10^q)) + 63, with the multiplier fitted by Lemire.
+    int32_t power = (int32_t) (((152170 + 65536) * q) >> 16) + 63;
+    answer.power2 = power + upperBit - leadingZeros + DOUBLE_EXPONENT_BIAS;
+
+    if (answer.power2 <= 0) {
+        if (-answer.power2 + 1 >= 64) return {0, 0};
+        answer.mantissa >>= -answer.power2 + 1;
+        answer.mantissa += answer.mantissa & 1;
+        answer.mantissa >>= 1;
+        answer.power2 = answer.mantissa < (1ull << DOUBLE_MANTISSA_BITS) ? 0 : 1;
+        return answer;
+    }
+
+    // Exactly halfway between two doubles is only possible while 5^q fits in 64 bits; then
+    // round to even instead of up.
+    if (low <= 1 && q >= -4 && q <= 23 && (answer.mantissa & 3) == 1 && (answer.mantissa << shift) == high) {
+        answer.mantissa &= ~1ull;
+    }
+    answer.mantissa += answer.mantissa & 1;
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= 2ull << DOUBLE_MANTISSA_BITS) {
+        answer.mantissa = 1ull << DOUBLE_MANTISSA_BITS;
+        answer.power2++;
+    }
+    answer.mantissa &= ~(1ull << DOUBLE_MANTISSA_BITS);
+    if (answer.power2 >= DOUBLE_INFINITE_POWER) return {0, DOUBLE_INFINITE_POWER};
+    return answer;
+}
+
+double parseDecimal(const char *start, const char *end) {
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    int digits = 0;
+    bool fraction = false;
+    // Set when a non-zero digit past the 19th had to be dropped.
+    bool truncated = false;
+    for (const char *c = start; c < end; c++) {
+        if (*c == '.') {
+            fraction = true;
+            continue;
+        }
+        uint32_t digit = *c - '0';
+        if (digits < 19) {
+            if (mantissa != 0 || digit != 0) {
+                mantissa = mantissa * 10 + digit;
+                digits++;
+            }
+            if (fraction) exponent--;
+        } else {
+            truncated |= digit != 0;
+            if (!fraction) exponent++;
+        }
+    }
+    if (mantissa == 0) return 0.0;
+
+    // Clinger's fast path: both operands are exact doubles, so one rounding gives the answer.
+    if (!truncated && mantissa <= 1ull << 53 && exponent >= -22 && exponent <= 22) {
+        auto value = (double) mantissa;
+        return exponent < 0 ? value / exactPowersOfTen[-exponent] : value * exactPowersOfTen[exponent];
+    }
+
+    BinaryFloat result = eiselLemire(exponent, mantissa);
+    // The dropped digits put the value between mantissa and mantissa + 1; when both round to
+    // the same double that is the answer, otherwise only an exact conversion can tell.
+    if (!truncated || result == eiselLemire(exponent, mantissa + 1)) return toDouble(result);
+    std::string text(start, end);
+    return strtod(text.c_str(), nullptr);
+}
+
+// A double as digits * 10^exponent.
+struct DecimalFloat {
+    uint64_t digits;
+    int32_t exponent;
+};
+
+static uint32_t pow5Bits(int32_t e) {
+    return (uint32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+static uint32_t log10Pow2(int32_t e) {
+    return ((uint32_t) e * 78913) >> 18;
+}
+
+static uint32_t log10Pow5(int32_t e) {
+    return ((uint32_t) e * 732923) >> 20;
+}
+
+static bool multipleOfPowerOf5(uint64_t value, uint32_t power) {
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count >= power;
+}
+
+static bool multipleOfPowerOf2(uint64_t value, uint32_t power) {
+    return (value & ((1ull << power) - 1)) == 0;
+}
+
+static uint64_t mulShift64(uint64_t m, const uint64_t *multiplier, int32_t shift) {
+    uint128_t low = (uint128_t) m * multiplier[0];
+    uint128_t high = (uint128_t) m * multiplier[1];
+    return (uint64_t) (((low >> 64) + high) >> (shift - 64));
+}
+
+// Ryu (Ulf Adams, 2018): the shortest digits inside the interval of reals that round to the
+// double, picking the one closest to it.
+static DecimalFloat shortestDigits(uint64_t ieeeMantissa, uint32_t ieeeExponent) {
+    int32_t e2;
+    uint64_t m2;
+    if (ieeeExponent == 0) {
+        e2 = 1 - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    } else {
+        e2 = (int32_t) ieeeExponent - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ull << DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+    }
+    const bool acceptBounds = (m2 & 1) == 0;
+
+    // The interval's bounds and the value itself, times four, with the lower bound closer
+    // at powers of two.
+    const uint64_t mv = 4 * m2;
+    const uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    bool vmIsTrailingZeros = false;
+    bool vrIsTrailingZeros = false;
+    if (e2 >= 0) {
+        const uint32_t q = log10Pow2(e2) - (e2 > 3);
+        e10 = (int32_t) q;
+        const int32_t k = POW5_BITCOUNT + (int32_t) pow5Bits((int32_t) q) - 1;
+        const int32_t i = -e2 + (int32_t) q + k;
+        const uint64_t *multiplier = powerTables.pow5Inverse[q];
+        vr = mulShift64(4 * m2, multiplier, i);
+        vp = mulShift64(4 * m2 + 2, multiplier, i);
+        vm = mulShift64(4 * m2 - 1 - mmShift, multiplier, i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+            } else if (acceptBounds) {
+                vmIsTrailingZeros = multipleOfPowerOf5(mv - 1 - mmShift, q);
+            } else {
+                vp -= multipleOfPowerOf5(mv + 2, q);
+            }
+        }
+    } else {
+        const uint32_t q = log10Pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t) q + e2;
+        const int32_t i = -e2 - (int32_t) q;
+        const int32_t k = (int32_t) pow5Bits(i) - POW5_BITCOUNT;
+        const int32_t j = (int32_t) q - k;
+        const uint64_t *multiplier = powerTables.pow5[i];
+        vr = mulShift64(4 * m2, multiplier, j);
+        vp = mulShift64(4 * m2 + 2, multiplier, j);
+        vm = mulShift64(4 * m2 - 1 - mmShift, multiplier, j);
+        if (q <= 1) {
+            // mv has at least two trailing zero bits, so vr is exact.
+            vrIsTrailingZeros = true;
+            if (acceptBounds) {
+                vmIsTrailingZeros = mmShift == 1;
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vrIsTrailingZeros = multipleOfPowerOf2(mv, q);
+        }
+    }
+
+    // Drop digits while the bounds still differ, remembering how to round vr.
+    int32_t removed = 0;
+    uint8_t lastRemovedDigit = 0;
+    uint64_t output;
+    if (vmIsTrailingZeros || vrIsTrailingZeros) {
+        while (vp / 10 > vm / 10) {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vmIsTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (uint8_t) (vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        // Exactly halfway: round to even.
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) lastRemovedDigit = 4;
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+    } else {
+        bool roundUp = false;
+        if (vp / 100 > vm / 100) {
+            roundUp = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            roundUp = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || roundUp);
+    }
+    return {output, e10 + removed};
+}
+
+// Integers below 2^53 are printed from their own value; Ryu would give the same digits.
+static bool smallInteger(uint64_t ieeeMantissa, uint32_t ieeeExponent, DecimalFloat *decimal) {
+    int32_t e2 = (int32_t) ieeeExponent - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS;
+    if (e2 > 0 || e2 < -DOUBLE_MANTISSA_BITS) return false;
+    uint64_t m2 = (1ull << DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+    if ((m2 & ((1ull << -e2) - 1)) != 0) return false;
+    decimal->digits = m2 >> -e2;
+    decimal->exponent = 0;
+    while (decimal->digits % 10 == 0) {
+        decimal->digits /= 10;
+        decimal->exponent++;
+    }
+    return true;
+}
+
+static int writeDigits(uint64_t digits, char *buffer) {
+    char reversed[20];
+    int count = 0;
+    do {
+        reversed[count++] = (char) ('0' + digits % 10);
+        digits /= 10;
+    } while (digits != 0);
+    for (int i = 0; i < count; i++) buffer[i] = reversed[count - 1 - i];
+    return count;
+}
+
+int formatDouble(double value, char *buffer) {
+    auto bits = std::bit_cast<uint64_t>(value);
+    bool negative = bits >> 63;
+    uint64_t ieeeMantissa = bits & ((1ull << DOUBLE_MANTISSA_BITS) - 1);
+    auto ieeeExponent = (uint32_t) ((bits >> DOUBLE_MANTISSA_BITS) & DOUBLE_INFINITE_POWER);
+
+    char *out = buffer;
+    if (ieeeExponent == DOUBLE_INFINITE_POWER && ieeeMantissa != 0) {
+        memcpy(out, "nan", 4);
+        return 3;
+    }
+    if (negative) *out++ = '-';
+    if (ieeeExponent == DOUBLE_INFINITE_POWER) {
+        memcpy(out, "inf", 4);
+        return (int) (out - buffer) + 3;
+    }
+    if (ieeeExponent == 0 && ieeeMantissa == 0) {
+        *out++ = '0';
+        *out = '\0';
+        return (int) (out - buffer);
+    }
+
+    DecimalFloat decimal;
+    if (!smallInteger(ieeeMantissa, ieeeExponent, &decimal)) decimal = shortestDigits(ieeeMantissa, ieeeExponent);
+
+    char digits[20];
+    int length = writeDigits(decimal.digits, digits);
+    // The value is 0.digits * 10^point.
+    int point = decimal.exponent + length;
+    if (length <= point && point <= 21) {
+        memcpy(out, digits, length);
+        out += length;
+        memset(out, '0', point - length);
+        out += point - length;
+    } else if (0 < point && point <= 21) {
+        memcpy(out, digits, point);
+        out += point;
+        *out++ = '.';
+        memcpy(out, digits + point, length - point);
+        out += length - point;
+    } else if (-6 < point && point <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -point);
+        out += -point;
+        memcpy(out, digits, length);
+        out += length;
+    } else {
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, length - 1);
+            out += length - 1;
+        }
+        int exponent = point - 1;
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        out += writeDigits(exponent < 0 ? -exponent : exponent, out);
+    }
+    *out = '\0';
+    return (int) (out - buffer);
+}
@@ -2,33 +2,145 @@
 // Created by Sergei Lukaushkin on 19.06.2023.
 //
 
-#include <libc.h>
+#include <bit>
+#include <cstring>
 #include "object.hh"
+#include "map.hh"
 #include "memory.hh"
+#include "table.hh"
+#include "vm.hh"
 
-#define ALLOCATE_OBJ(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+static size_t stringSize(int length) {
+    return sizeof(ObjString) + length + 1;
+}
+
+// The elements follow the header in the same slot, at the first aligned address.
+static size_t arraySize(int32_t count) {
+    return sizeof(ObjArray) + ARRAY_ALIGNMENT - 1 + sizeof(double) * count;
+}
+
+static MemoryCategory objectCategory(ObjectType type) {
+    return type == ObjectType::STRING ? MemoryCategory::STRINGS : MemoryCategory::OBJECTS;
+}
 
 static Obj *allocateObject(size_t size, ObjectType type) {
-    Obj *object = static_cast<Obj *>(reallocate(nullptr, 0, size));
+    uint8_t sizeClass;
+    Obj *object = static_cast<Obj *>(allocateSlot(size, objectCategory(type), &sizeClass));
+    if (object == nullptr) return nullptr;
     object->type = type;
+    object->sizeClass = sizeClass;
+    object->isMarked = false;
+    object->reserved = 0;
     return object;
 }
 
-static ObjString *allocateString(char *chars, int length) {
-    ObjString *string = ALLOCATE_OBJ(ObjString, ObjectType::STRING);
+ObjString *allocateString(int length) {
+    auto string = (ObjString *) allocateObject(stringSize(length), ObjectType::STRING);
+    if (string == nullptr) return nullptr;
     string->length = length;
-    string->chars = chars;
+    string->chars[length] = '\0';
+    return string;
+}
+
+// Every new string is hashed for interning, megabyte literals included, so this takes eight
+// bytes per multiply-rotate step (as in FxHash) instead of one.
+#define HASH_MULTIPLIER 0x517cc1b727220a95u
+
+static uint64_t hashStep(uint64_t hash, uint64_t word) {
+    return (std::rotl(hash, 5) ^ word) * HASH_MULTIPLIER;
+}
+
+uint32_t hashString(const char *chars, int length) {
+    uint64_t hash = 0;
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, chars + i, sizeof(word));
+        hash = hashStep(hash, word);
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, chars + i, length - i);
+        hash = hashStep(hash, word);
+    }
+    // The high half of the last product depends on every input bit.
+    return (uint32_t) (hashStep(hash, length) >> 32);
+}
+
+ObjString *internString(ObjString *string) {
+    string->hash = hashString(string->chars, string->length);
+    ObjString *interned = tableFindString(&vm.strings, string->chars, string->length, string->hash);
+    if (interned != nullptr || !tableReserve(&vm.strings)) {
+        freeObject((Obj *) string);
+        return interned;
+    }
+    tableSet(&vm.strings, string, Value());
     return string;
 }
 
 ObjString *copyString(const char *chars, int length) {
-    char *heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocateString(heapChars, length);
+    uint32_t hash = hashString(chars, length);
+    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    if (interned != nullptr) return interned;
+
+    if (!tableReserve(&vm.strings)) return nullptr;
+    ObjString *string = allocateString(length);
+    if (string == nullptr) return nullptr;
+    memcpy(string->chars, chars, length);
+    string->hash = hash;
+    tableSet(&vm.strings, string, Value());
+    return string;
+}
+
+ObjNative *allocateNative(ObjString *name, NativeSignature signature, uint8_t arity) {
+    auto native = (ObjNative *) allocateObject(sizeof(ObjNative), ObjectType::NATIVE);
+    if (native == nullptr) return nullptr;
+    native->signature = signature;
+    native->arity = arity;
+    native->name = name;
+    return native;
+}
+
+ObjArray *allocateArray(int32_t count) {
+    auto array = (ObjArray *) allocateObject(arraySize(count), ObjectType::ARRAY);
+    if (array == nullptr) return nullptr;
+    array->count = count;
+    auto storage = (uintptr_t) (array + 1);
+    array->values = (double *) ((storage + ARRAY_ALIGNMENT - 1) & ~(uintptr_t) (ARRAY_ALIGNMENT - 1));
+    return array;
+}
+
+ObjMap *allocateMap() {
+    auto map = (ObjMap *) allocateObject(sizeof(ObjMap), ObjectType::MAP);
+    if (map == nullptr) return nullptr;
+    initMap(&map->map);
+    return map;
+}
+
+ObjString *adoptString(ObjString *string) {
+    ObjString *interned = tableFindString(&vm.strings, string->chars, string->length, string->hash);
+    if (interned != nullptr) return interned;
+    if (!tableReserve(&vm.strings)) return nullptr;
+    tableSet(&vm.strings, string, Value());
+    return string;
 }
 
-ObjString *takeString(char *chars, int length) {
-    return allocateString(chars, length);
+void freeObject(Obj *object) {
+    switch (object->type) {
+        case ObjectType::STRING:
+            freeSlot(object, stringSize(((ObjString *) object)->length), object->sizeClass,
+                     objectCategory(object->type));
+            break;
+        case ObjectType::NATIVE:
+            freeSlot(object, sizeof(ObjNative), object->sizeClass, objectCategory(object->type));
+            break;
+        case ObjectType::ARRAY:
+            freeSlot(object, arraySize(((ObjArray *) object)->count), object->sizeClass,
+                     objectCategory(object->type));
+            break;
+        case ObjectType::MAP:
+            freeMap(&((ObjMap *) object)->map);
+            freeSlot(object, sizeof(ObjMap), object->sizeClass, objectCategory(object->type));
+            break;
+    }
 }
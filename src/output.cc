@@ -0,0 +1,52 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "output.hh"
+#include "vm.hh"
+
+// A failed write, typically a closed pipe, drops the rest: there is nobody left to tell.
+static void writeStandardOutput(const char *data, size_t length) {
+    fflush(stdout);
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        data += written;
+        length -= written;
+    }
+}
+
+static void emit(const char *data, size_t length) {
+    if (vm.output.sink != nullptr) {
+        vm.output.sink(vm.output.context, data, length);
+    } else {
+        writeStandardOutput(data, length);
+    }
+}
+
+void writeOutput(const char *data, size_t length) {
+    Output *output = &vm.output;
+    if (length > OUTPUT_BUFFER_SIZE - output->length) {
+        flushOutput();
+        if (length >= OUTPUT_BUFFER_SIZE) {
+            emit(data, length);
+            return;
+        }
+    }
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
+
+void flushOutput() {
+    if (vm.output.length == 0) return;
+    uint32_t length = vm.output.length;
+    vm.output.length = 0;
+    emit(vm.output.data, length);
+}
+
+void setOutputSink(OutputSink sink, void *context) {
+    flushOutput();
+    vm.output.sink = sink;
+    vm.output.context = context;
+}
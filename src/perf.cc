@@ -0,0 +1,170 @@
+#include <ctime>
+#include "perf.hh"
+
+#if defined(__linux__)
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#endif
+
+#define PHASE_COUNT static_cast<size_t>(PerfPhase::COUNT)
+#define COUNTER_COUNT static_cast<size_t>(PerfCounter::COUNT)
+
+bool perfStatsEnabled = false;
+
+static PerfPhaseStats phases[PHASE_COUNT];
+static uint64_t phaseStart[PHASE_COUNT];
+static int counterFds[COUNTER_COUNT] = {-1, -1, -1, -1, -1};
+
+static uint64_t monotonicNanoseconds() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+#if defined(__linux__)
+
+struct CounterReading {
+    uint64_t value;
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+};
+
+static int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cacheMissConfig(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+void enablePerfStats() {
+    counterFds[static_cast<size_t>(PerfCounter::CYCLES)] =
+            openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counterFds[static_cast<size_t>(PerfCounter::INSTRUCTIONS)] =
+            openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counterFds[static_cast<size_t>(PerfCounter::BRANCH_MISSES)] =
+            openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counterFds[static_cast<size_t>(PerfCounter::L1D_MISSES)] =
+            openCounter(PERF_TYPE_HW_CACHE, cacheMissConfig(PERF_COUNT_HW_CACHE_L1D));
+    counterFds[static_cast<size_t>(PerfCounter::LLC_MISSES)] =
+            openCounter(PERF_TYPE_HW_CACHE, cacheMissConfig(PERF_COUNT_HW_CACHE_LL));
+    perfStatsEnabled = true;
+}
+
+void beginPerfPhase(PerfPhase phase) {
+    for (int fd: counterFds) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    phaseStart[static_cast<size_t>(phase)] = monotonicNanoseconds();
+}
+
+void endPerfPhase(PerfPhase phase) {
+    uint64_t elapsed = monotonicNanoseconds() - phaseStart[static_cast<size_t>(phase)];
+    PerfPhaseStats &stats = phases[static_cast<size_t>(phase)];
+    for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+        int fd = counterFds[counter];
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        CounterReading reading{};
+        if (read(fd, &reading, sizeof(reading)) != sizeof(reading)) continue;
+        // The kernel multiplexes counters when there are too few registers; scale to the full phase.
+        if (reading.timeRunning > 0 && reading.timeRunning < reading.timeEnabled) {
+            reading.value = (uint64_t) ((double) reading.value *
+                                        (double) reading.timeEnabled / (double) reading.timeRunning);
+        }
+        stats.counters[counter] += reading.value;
+    }
+    stats.nanoseconds += elapsed;
+    stats.runs++;
+}
+
+#else
+
+void enablePerfStats() {
+    perfStatsEnabled = true;
+}
+
+void beginPerfPhase(PerfPhase phase) {
+    phaseStart[static_cast<size_t>(phase)] = monotonicNanoseconds();
+}
+
+void endPerfPhase(PerfPhase phase) {
+    PerfPhaseStats &stats = phases[static_cast<size_t>(phase)];
+    stats.nanoseconds += monotonicNanoseconds() - phaseStart[static_cast<size_t>(phase)];
+    stats.runs++;
+}
+
+#endif
+
+const PerfPhaseStats &perfPhaseStats(PerfPhase phase) {
+    return phases[static_cast<size_t>(phase)];
+}
+
+static const char *phaseName(size_t phase) {
+    switch (static_cast<PerfPhase>(phase)) {
+        case PerfPhase::SCAN:
+            return "scan";
+        case PerfPhase::COMPILE:
+            return "compile";
+        case PerfPhase::EXECUTE:
+            return "execute";
+        default:
+            return "unknown";
+    }
+}
+
+static const char *counterName(size_t counter) {
+    switch (static_cast<PerfCounter>(counter)) {
+        case PerfCounter::CYCLES:
+            return "cycles";
+        case PerfCounter::INSTRUCTIONS:
+            return "instructions";
+        case PerfCounter::BRANCH_MISSES:
+            return "branch-misses";
+        case PerfCounter::L1D_MISSES:
+            return "L1d-misses";
+        case PerfCounter::LLC_MISSES:
+            return "LLC-misses";
+        default:
+            return "unknown";
+    }
+}
+
+void printPerfStats(FILE *out) {
+    fprintf(out, "== perf ==\n");
+    fprintf(out, "%-16s", "");
+    for (size_t phase = 0; phase < PHASE_COUNT; phase++) fprintf(out, " %16s", phaseName(phase));
+    fprintf(out, "\n%-16s", "wall-ns");
+    for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+        fprintf(out, " %16llu", (unsigned long long) phases[phase].nanoseconds);
+    }
+    fprintf(out, "\n");
+
+    for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+        fprintf(out, "%-16s", counterName(counter));
+        for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+            if (counterFds[counter] < 0) {
+                fprintf(out, " %16s", "n/a");
+            } else {
+                fprintf(out, " %16llu", (unsigned long long) phases[phase].counters[counter]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "(scan is a separate pass over the source; compile includes its own scanning)\n");
+}
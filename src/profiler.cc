@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cerrno>
+#include <sys/time.h>
+#include <vector>
+#include "profiler.hh"
+#include "debug.hh"
+
+#define TOP_PAIRS 20
+
+OpProfile opProfile;
+
+bool opProfilerEnabled = false;
+
+LineProfile lineProfile;
+
+bool lineProfilerEnabled = false;
+
+struct LineSample {
+    int32_t line;
+    uint64_t count;
+};
+
+static LineSample lineSamples[LINE_PROFILE_SLOTS];
+static uint64_t phaseSamples[3];
+static uint64_t droppedSamples;
+static const char *profilePath;
+static const char *profileScript;
+
+struct OpPair {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+};
+
+void enableOpProfiler() {
+    opProfile = OpProfile{};
+    opProfile.countdown = OP_SAMPLE_INTERVAL;
+    opProfilerEnabled = true;
+}
+
+static uint64_t totalCount() {
+    uint64_t total = 0;
+    for (uint64_t count: opProfile.counts) total += count;
+    return total;
+}
+
+static double averageCycles(size_t op) {
+    if (opProfile.samples[op] == 0) return 0;
+    return (double) opProfile.sampledCycles[op] / (double) opProfile.samples[op];
+}
+
+static std::vector<uint8_t> sortedOps() {
+    std::vector<uint8_t> ops;
+    for (size_t op = 0; op < OPCODE_COUNT; op++) {
+        if (opProfile.counts[op] > 0) ops.push_back((uint8_t) op);
+    }
+    std::sort(ops.begin(), ops.end(), [](uint8_t a, uint8_t b) {
+        return opProfile.counts[a] > opProfile.counts[b];
+    });
+    return ops;
+}
+
+static std::vector<OpPair> sortedPairs() {
+    std::vector<OpPair> pairs;
+    for (size_t first = 0; first < OPCODE_COUNT; first++) {
+        for (size_t second = 0; second < OPCODE_COUNT; second++) {
+            uint64_t count = opProfile.pairs[first][second];
+            if (count > 0) pairs.push_back({(uint8_t) first, (uint8_t) second, count});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const OpPair &a, const OpPair &b) {
+        return a.count > b.count;
+    });
+    if (pairs.size() > TOP_PAIRS) pairs.resize(TOP_PAIRS);
+    return pairs;
+}
+
+static const char *nameOf(uint8_t op) {
+    return opcodeName(static_cast<OpCode>(op));
+}
+
+static void printOpProfileText(FILE *out) {
+    uint64_t total = totalCount();
+    fprintf(out, "== opcodes ==\n");
+    fprintf(out, "%-16s %14s %8s %12s\n", "opcode", "count", "share", "cycles/op");
+    for (uint8_t op: sortedOps()) {
+        fprintf(out, "%-16s %14llu %7.2f%% %12.1f\n", nameOf(op),
+                (unsigned long long) opProfile.counts[op],
+                100.0 * (double) opProfile.counts[op] / (double) total, averageCycles(op));
+    }
+    fprintf(out, "%-16s %14llu\n", "total", (unsigned long long) total);
+
+    fprintf(out, "== opcode pairs ==\n");
+    for (const OpPair &pair: sortedPairs()) {
+        fprintf(out, "%-16s -> %-16s %14llu\n", nameOf(pair.first), nameOf(pair.second),
+                (unsigned long long) pair.count);
+    }
+}
+
+static void printOpProfileJson(FILE *out) {
+    fprintf(out, "{\"total\":%llu,\"opcodes\":[", (unsigned long long) totalCount());
+    bool first = true;
+    for (uint8_t op: sortedOps()) {
+        fprintf(out, "%s{\"name\":\"%s\",\"count\":%llu,\"cycles\":%.1f}", first ? "" : ",", nameOf(op),
+                (unsigned long long) opProfile.counts[op], averageCycles(op));
+        first = false;
+    }
+    fprintf(out, "],\"pairs\":[");
+    first = true;
+    for (const OpPair &pair: sortedPairs()) {
+        fprintf(out, "%s{\"first\":\"%s\",\"second\":\"%s\",\"count\":%llu}", first ? "" : ",",
+                nameOf(pair.first), nameOf(pair.second), (unsigned long long) pair.count);
+        first = false;
+    }
+    fprintf(out, "]}\n");
+}
+
+void printOpProfile(FILE *out, OpProfileFormat format) {
+    switch (format) {
+        case OpProfileFormat::TEXT:
+            printOpProfileText(out);
+            break;
+        case OpProfileFormat::JSON:
+            printOpProfileJson(out);
+            break;
+    }
+}
+
+static void recordLine(int32_t line) {
+    auto slot = (uint32_t) line * 2654435761u % LINE_PROFILE_SLOTS;
+    for (uint32_t probe = 0; probe < LINE_PROFILE_SLOTS; probe++) {
+        LineSample &sample = lineSamples[slot];
+        if (sample.line == line) {
+            sample.count++;
+            return;
+        }
+        if (sample.line == 0) {
+            sample.line = line;
+            sample.count = 1;
+            return;
+        }
+        slot = (slot + 1) % LINE_PROFILE_SLOTS;
+    }
+    droppedSamples++;
+}
+
+static void sampleLine(int) {
+    int savedErrno = errno;
+    ProfilePhase phase = lineProfile.phase;
+    const Chunk *chunk = lineProfile.chunk;
+    const uint8_t *ip = lineProfile.ip;
+    if (phase == ProfilePhase::EXECUTE && chunk != nullptr && ip != nullptr) {
+        // Same mapping as runtimeError(): ip already points past the opcode being executed.
+        recordLine(chunk->lines[ip - chunk->code - 1]);
+    } else {
+        phaseSamples[static_cast<size_t>(phase)]++;
+    }
+    errno = savedErrno;
+}
+
+bool startLineProfiler(const char *path, const char *scriptName) {
+    profilePath = path;
+    profileScript = scriptName;
+    lineProfile.chunk = nullptr;
+    lineProfile.ip = nullptr;
+    lineProfile.phase = ProfilePhase::IDLE;
+
+    struct sigaction action{};
+    action.sa_handler = sampleLine;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) return false;
+
+    itimerval timer{};
+    timer.it_interval.tv_usec = LINE_PROFILE_INTERVAL_USEC;
+    timer.it_value.tv_usec = LINE_PROFILE_INTERVAL_USEC;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) return false;
+
+    lineProfilerEnabled = true;
+    return true;
+}
+
+void stopLineProfiler() {
+    if (!lineProfilerEnabled) return;
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    lineProfilerEnabled = false;
+
+    FILE *out = fopen(profilePath, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "Could not write profile \"%s\".\n", profilePath);
+        return;
+    }
+
+    std::vector<LineSample> samples;
+    for (const LineSample &sample: lineSamples) {
+        if (sample.line != 0) samples.push_back(sample);
+    }
+    std::sort(samples.begin(), samples.end(), [](const LineSample &a, const LineSample &b) {
+        return a.line < b.line;
+    });
+
+    // Collapsed-stack format: semicolon-separated frames followed by the sample count.
+    for (const LineSample &sample: samples) {
+        fprintf(out, "%s;%s:%d %llu\n", profileScript, profileScript, sample.line,
+                (unsigned long long) sample.count);
+    }
+    if (phaseSamples[static_cast<size_t>(ProfilePhase::COMPILE)] > 0) {
+        fprintf(out, "%s;[compile] %llu\n", profileScript,
+                (unsigned long long) phaseSamples[static_cast<size_t>(ProfilePhase::COMPILE)]);
+    }
+    if (phaseSamples[static_cast<size_t>(ProfilePhase::IDLE)] > 0) {
+        fprintf(out, "%s;[runtime] %llu\n", profileScript,
+                (unsigned long long) phaseSamples[static_cast<size_t>(ProfilePhase::IDLE)]);
+    }
+    if (droppedSamples > 0) {
+        fprintf(out, "%s;[dropped] %llu\n", profileScript, (unsigned long long) droppedSamples);
+    }
+    fclose(out);
+}
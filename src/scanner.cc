@@ -2,26 +2,116 @@
 // Created by Sergei Lukaushkin on 17.06.2023.
 //
 
+#include <array>
+#include <bit>
 #include <cstring>
+#include <string_view>
 #include "scanner.hh"
 
+// The hot loops classify a whole block of source at once. Blocks are only loaded while a
+// full one remains before the end of the source.
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define SCANNER_BLOCKS 1
+typedef __m256i Block;
+#define BLOCK_SIZE 32
+#define FULL_MASK 0xFFFFFFFFu
+
+static inline Block loadBlock(const char *source) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source));
+}
+
+static inline uint32_t matchMask(Block block, char c) {
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+}
+
+// Shifting the range down to start at -128 lets one signed compare test both bounds.
+static inline uint32_t rangeMask(Block block, char low, char high) {
+    Block shifted = _mm256_add_epi8(block, _mm256_set1_epi8((char) (-128 - low)));
+    Block limit = _mm256_set1_epi8((char) (-128 + (high - low) + 1));
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, shifted));
+}
+
+static inline Block lowerCase(Block block) {
+    return _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SCANNER_BLOCKS 1
+typedef __m128i Block;
+#define BLOCK_SIZE 16
+#define FULL_MASK 0xFFFFu
+
+static inline Block loadBlock(const char *source) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(source));
+}
+
+static inline uint32_t matchMask(Block block, char c) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+}
+
+// Shifting the range down to start at -128 lets one signed compare test both bounds.
+static inline uint32_t rangeMask(Block block, char low, char high) {
+    Block shifted = _mm_add_epi8(block, _mm_set1_epi8((char) (-128 - low)));
+    Block limit = _mm_set1_epi8((char) (-128 + (high - low) + 1));
+    return (uint32_t) _mm_movemask_epi8(_mm_cmplt_epi8(shifted, limit));
+}
+
+static inline Block lowerCase(Block block) {
+    return _mm_or_si128(block, _mm_set1_epi8(0x20));
+}
+
+#else
+
+// Without SIMD the block paths compile away and every run is scanned a byte at a time.
+#define SCANNER_BLOCKS 0
+typedef uint32_t Block;
+#define BLOCK_SIZE 1
+#define FULL_MASK 0u
+
+static inline Block loadBlock(const char *) { return 0; }
+
+static inline uint32_t matchMask(Block, char) { return 0; }
+
+static inline uint32_t rangeMask(Block, char, char) { return 0; }
+
+static inline Block lowerCase(Block block) { return block; }
+
+#endif
+
 
 struct Scanner {
     const char *start;
     const char *current;
+    const char *end;
     int32_t line;
 };
 
-Scanner scanner;
+// Per thread, so chunks of one source can be tokenized in parallel.
+thread_local Scanner scanner;
 
-void initScanner(const char *source) {
+void initScanner(const char *source, size_t length) {
     scanner.start = source;
     scanner.current = source;
+    scanner.end = source + length;
     scanner.line = 1;
 }
 
+const char *lastTokenStart() {
+    return scanner.start;
+}
+
 static bool isAtEnd() {
-    return *scanner.current == '\0';
+    return scanner.current >= scanner.end;
+}
+
+static inline bool canLoadBlock(const char *source) {
+    return scanner.end - source >= BLOCK_SIZE;
 }
 
 static Token makeToken(TokenType type) {
@@ -54,15 +144,86 @@ static bool match(char expected) {
     return true;
 }
 
+// Past the end of the source both read as '\0', which no token continues with.
 static char peek() {
+    if (isAtEnd()) return '\0';
     return *scanner.current;
 }
 
 static char peekNext() {
-    if (isAtEnd()) return '\0';
+    if (scanner.end - scanner.current < 2) return '\0';
     return scanner.current[1];
 }
 
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool isAlpha(char c) {
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           c == '_';
+}
+
+// Moves past the first `count` bytes of a block, counting the newlines among them.
+static void advanceBlock(uint32_t count, uint32_t newlines) {
+    if (count < 32) newlines &= (1u << count) - 1;
+    for (; newlines != 0; newlines &= newlines - 1) scanner.line++;
+    scanner.current += count;
+}
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+static bool isIdentifierChar(char c) {
+    return isAlpha(c) || isDigit(c);
+}
+
+// Most tokens and gaps are short, so each run is first scanned a byte at a time and only
+// continues block-wise past SCALAR_PREFIX bytes. Within a block of the end of the source the
+// rest is scanned a byte at a time.
+#define SCALAR_PREFIX 16
+
+#define SCAN_RUN(name, continues, countsLines, blockStop, blockNewlines) \
+    static void name() { \
+        for (int32_t i = 0; i < SCALAR_PREFIX; i++) { \
+            char c = peek(); \
+            if (!(continues)) return; \
+            if (countsLines && c == '\n') scanner.line++; \
+            advance(); \
+        } \
+        for (;;) { \
+            if (SCANNER_BLOCKS && canLoadBlock(scanner.current)) { \
+                Block block = loadBlock(scanner.current); \
+                uint32_t stop = (blockStop) & FULL_MASK; \
+                advanceBlock(stop == 0 ? BLOCK_SIZE : std::countr_zero(stop), blockNewlines); \
+                if (stop != 0) return; \
+                continue; \
+            } \
+            char c = peek(); \
+            if (!(continues)) return; \
+            if (countsLines && c == '\n') scanner.line++; \
+            advance(); \
+        } \
+    }
+
+SCAN_RUN(skipBlanks, isBlank(c), true,
+         ~(matchMask(block, ' ') | matchMask(block, '\t') | matchMask(block, '\r') | matchMask(block, '\n')),
+         matchMask(block, '\n'))
+
+// Stops on the newline so skipWhitespace() counts it.
+SCAN_RUN(skipLineComment, c != '\n' && !isAtEnd(), false,
+         matchMask(block, '\n'), 0)
+
+SCAN_RUN(skipStringBody, c != '"' && !isAtEnd(), true,
+         matchMask(block, '"'), matchMask(block, '\n'))
+
+SCAN_RUN(skipIdentifierRest, isIdentifierChar(c), false,
+         ~(rangeMask(lowerCase(block), 'a', 'z') | rangeMask(block, '0', '9') | matchMask(block, '_')), 0)
+
+#undef SCAN_RUN
+
 static void skipWhitespace() {
     for (;;) {
         char c = peek();
@@ -70,42 +231,42 @@ static void skipWhitespace() {
             case ' ':
             case '\r':
             case '\t':
-                advance();
-                break;
             case '\n':
-                scanner.line++;
+                if (c == '\n') scanner.line++;
                 advance();
+                if (isBlank(peek())) skipBlanks();
                 break;
             case '/':
                 if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                    skipLineComment();
                 } else {
                     return;
                 }
+                break;
             default:
                 return;
         }
     }
 }
 
-static bool isDigit(char c) {
-    return c >= '0' && c <= '9';
+// Number literals are a few digits long, too short for block scanning to pay off; a local
+// cursor at least keeps the bounds check to one compare per digit.
+static const char *skipDigitRun(const char *current) {
+    while (current < scanner.end && isDigit(*current)) current++;
+    return current;
 }
 
 static Token number() {
-    while (isDigit(peek())) advance();
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();
-        while (isDigit(peek())) advance();
+    const char *current = skipDigitRun(scanner.current);
+    if (scanner.end - current >= 2 && current[0] == '.' && isDigit(current[1])) {
+        current = skipDigitRun(current + 1);
     }
+    scanner.current = current;
     return makeToken(TokenType::NUMBER);
 }
 
 static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
+    skipStringBody();
 
     if (isAtEnd()) return errorToken("Unterminated string.");
 
@@ -113,71 +274,74 @@ static Token string() {
     return makeToken(TokenType::STRING);
 }
 
-bool isAlpha(char c) {
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           c == '_';
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+// Keywords are found with a perfect hash of the first two characters and the length,
+// verified below when the table is built.
+#define KEYWORD_SLOTS 32
+#define MAX_KEYWORD_LENGTH 6
+
+static constexpr uint32_t keywordHash(char first, char second, size_t length) {
+    return ((uint32_t) first + 2 * (uint32_t) second + 10 * (uint32_t) length) & (KEYWORD_SLOTS - 1);
 }
 
-static TokenType checkKeyword(int32_t start, int32_t length, const char *rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
-        return type;
+static constexpr Keyword keywordList[] = {
+        {"and",    TokenType::AND},
+        {"class",  TokenType::CLASS},
+        {"else",   TokenType::ELSE},
+        {"false",  TokenType::FALSE},
+        {"for",    TokenType::FOR},
+        {"fun",    TokenType::FUN},
+        {"if",     TokenType::IF},
+        {"nil",    TokenType::NIL},
+        {"or",     TokenType::OR},
+        {"print",  TokenType::PRINT},
+        {"return", TokenType::RETURN},
+        {"super",  TokenType::SUPER},
+        {"this",   TokenType::THIS},
+        {"true",   TokenType::TRUE},
+        {"var",    TokenType::VAR},
+        {"while",  TokenType::WHILE},
+};
+
+static constexpr std::array<Keyword, KEYWORD_SLOTS> makeKeywordTable() {
+    std::array<Keyword, KEYWORD_SLOTS> table{};
+    for (const Keyword &keyword: keywordList) {
+        table[keywordHash(keyword.text[0], keyword.text[1], keyword.text.size())] = keyword;
     }
-    return TokenType::ERROR;
+    return table;
 }
 
+static constexpr std::array<Keyword, KEYWORD_SLOTS> keywords = makeKeywordTable();
+
+static constexpr bool keywordTableIsPerfect() {
+    for (const Keyword &keyword: keywordList) {
+        if (keyword.text.size() < 2 || keyword.text.size() > MAX_KEYWORD_LENGTH) return false;
+        if (keywords[keywordHash(keyword.text[0], keyword.text[1], keyword.text.size())].type != keyword.type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(keywordTableIsPerfect(), "keywordHash() collides; pick new multipliers");
+
 static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a':
-            return checkKeyword(1, 2, "nd", TokenType::AND);
-        case 'c':
-            return checkKeyword(1, 4, "lass", TokenType::CLASS);
-        case 'e':
-            return checkKeyword(1, 3, "lse", TokenType::ELSE);
-        case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a':
-                        return checkKeyword(2, 3, "lse", TokenType::FALSE);
-                    case 'o':
-                        return checkKeyword(2, 1, "r", TokenType::FOR);
-                    case 'u':
-                        return checkKeyword(2, 1, "n", TokenType::FUN);
-                }
-            }
-            break;
-        case 'i':
-            return checkKeyword(1, 1, "f", TokenType::IF);
-        case 'n':
-            return checkKeyword(1, 2, "il", TokenType::NIL);
-        case 'o':
-            return checkKeyword(1, 1, "r", TokenType::OR);
-        case 'p':
-            return checkKeyword(1, 4, "rint", TokenType::PRINT);
-        case 'r':
-            return checkKeyword(1, 5, "eturn", TokenType::RETURN);
-        case 's':
-            return checkKeyword(1, 4, "uper", TokenType::SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h':
-                        return checkKeyword(2, 2, "is", TokenType::THIS);
-                    case 'r':
-                        return checkKeyword(2, 2, "ue", TokenType::TRUE);
-                }
-            }
-        case 'v':
-            return checkKeyword(1, 2, "ar", TokenType::VAR);
-        case 'w':
-            return checkKeyword(1, 4, "hile", TokenType::WHILE);
+    size_t length = scanner.current - scanner.start;
+    if (length < 2 || length > MAX_KEYWORD_LENGTH) return TokenType::IDENTIFIER;
+
+    const Keyword &keyword = keywords[keywordHash(scanner.start[0], scanner.start[1], length)];
+    if (keyword.text.size() == length && memcmp(scanner.start, keyword.text.data(), length) == 0) {
+        return keyword.type;
     }
     return TokenType::IDENTIFIER;
 }
 
 static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
+    skipIdentifierRest();
     return makeToken(identifierType());
 }
 
@@ -0,0 +1,193 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "scheduler.hh"
+#include "compiler.hh"
+#include "memory.hh"
+
+// A script between two slices: where it stopped and what it had on the stack.
+struct Task {
+    std::string source;
+    Chunk chunk;
+    bool compiled;
+    uint8_t *ip;
+    std::vector<Value> stack;
+    // Globals the script defined or assigned, by slot.
+    std::vector<std::pair<int32_t, Value>> globals;
+    MemoryQuota memory;
+    ScriptDone done;
+    void *context;
+};
+
+struct SchedulerThread {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<Task *> incoming;
+    bool stopping;
+    // Scripts given to this thread that have not finished, for picking the least loaded one.
+    std::atomic<uint32_t> load;
+};
+
+// Scripts on one thread share its VM's global slots, so each brings its own values along.
+// Both directions only touch the slots the script wrote, not every global of the VM.
+static void restoreGlobals(const Task *task) {
+    resetGlobals();
+    for (auto [slot, value]: task->globals) writeGlobal(slot, value);
+}
+
+static void saveGlobals(Task *task) {
+    task->globals.clear();
+    for (int32_t i = 0; i < vm.writtenGlobalCount; i++) {
+        int32_t slot = vm.writtenGlobals[i];
+        task->globals.emplace_back(slot, vm.globals[slot].value);
+    }
+}
+
+// Swaps the script into this thread's VM for one quantum and back out if it yielded.
+// Its allocations are charged to its own quota; the caller restores the VM's.
+static InterpretResult runSlice(Scheduler *scheduler, Task *task) {
+    setMemoryQuota(&task->memory);
+    if (!task->compiled) {
+        initChunk(&task->chunk);
+        if (!compile(task->source.data(), task->source.size(), &task->chunk)) {
+            freeChunk(&task->chunk);
+            return InterpretResult::COMPILE_ERROR;
+        }
+        task->compiled = true;
+        task->ip = task->chunk.code;
+        std::string().swap(task->source);
+    }
+
+    restoreGlobals(task);
+    vm.chunk = &task->chunk;
+    vm.ip = task->ip;
+    std::copy(task->stack.begin(), task->stack.end(), vm.stack);
+    vm.stackTop = vm.stack + task->stack.size();
+    InterpretResult result = runBudgeted(scheduler->quantum);
+    if (result == InterpretResult::YIELD) {
+        task->ip = vm.ip;
+        task->stack.assign(vm.stack, vm.stackTop);
+        saveGlobals(task);
+    }
+    vm.chunk = nullptr;
+    return result;
+}
+
+static void finishTask(Scheduler *scheduler, SchedulerThread *thread, Task *task, InterpretResult result) {
+    task->done(task->context, result, result == InterpretResult::OK ? vm.result : Value(), task->memory.peakBytes);
+    if (task->compiled) freeChunk(&task->chunk);
+    delete task;
+    thread->load--;
+    if (--scheduler->pending == 0) scheduler->pending.notify_all();
+}
+
+// Returns false when the VM is out of memory without its natives; its scripts then fail.
+static bool startVM() {
+    bool started = initVM();
+    if (!started) fprintf(stderr, "Out of memory.\n");
+    vm.captureResult = true;
+    return started;
+}
+
+// Only when no started script is left, so nothing still points into the heap.
+static bool restartVM() {
+    freeVM();
+    return startVM();
+}
+
+// Past SCHEDULER_HEAP_LIMIT or SCHEDULER_GLOBAL_LIMIT scripts that have not started yet are held
+// back until the started ones finish, then the VM starts over; so the heap and the global slots
+// are bounded even while scripts keep arriving.
+static void runThread(Scheduler *scheduler, SchedulerThread *thread) {
+    bool started = startVM();
+    std::deque<Task *> ready;
+    std::deque<Task *> heldBack;
+    for (;;) {
+        bool draining = memoryStats().liveBytes > SCHEDULER_HEAP_LIMIT || vm.globalCount > SCHEDULER_GLOBAL_LIMIT;
+        if (ready.empty() && !heldBack.empty()) {
+            started = restartVM();
+            ready.swap(heldBack);
+            draining = false;
+        }
+        {
+            std::unique_lock lock(thread->lock);
+            if (ready.empty()) {
+                if (draining || !started) {
+                    started = restartVM();
+                    draining = false;
+                }
+                thread->wake.wait(lock, [&] { return thread->stopping || !thread->incoming.empty(); });
+                if (thread->incoming.empty()) break;
+            }
+            ready.insert(ready.end(), thread->incoming.begin(), thread->incoming.end());
+            thread->incoming.clear();
+        }
+
+        Task *task = ready.front();
+        ready.pop_front();
+        if (draining && !task->compiled) {
+            heldBack.push_back(task);
+            continue;
+        }
+        InterpretResult result = started ? runSlice(scheduler, task) : InterpretResult::RUNTIME_ERROR;
+        if (result == InterpretResult::YIELD) {
+            ready.push_back(task);
+        } else {
+            finishTask(scheduler, thread, task, result);
+        }
+        setMemoryQuota(&vm.memory);
+    }
+    freeVM();
+}
+
+void initScheduler(Scheduler *scheduler, uint32_t threads, uint32_t quantum) {
+    scheduler->threads = new SchedulerThread[threads]();
+    scheduler->threadCount = threads;
+    scheduler->quantum = quantum;
+    scheduler->pending = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        scheduler->threads[i].thread = std::thread(runThread, scheduler, &scheduler->threads[i]);
+    }
+}
+
+void freeScheduler(Scheduler *scheduler) {
+    drainScheduler(scheduler);
+    for (uint32_t i = 0; i < scheduler->threadCount; i++) {
+        SchedulerThread *thread = &scheduler->threads[i];
+        {
+            std::lock_guard lock(thread->lock);
+            thread->stopping = true;
+        }
+        thread->wake.notify_one();
+        thread->thread.join();
+    }
+    delete[] scheduler->threads;
+    scheduler->threads = nullptr;
+    scheduler->threadCount = 0;
+}
+
+void submitScript(Scheduler *scheduler, const char *source, size_t length, size_t memoryLimit,
+                  ScriptDone done, void *context) {
+    SchedulerThread *target = &scheduler->threads[0];
+    for (uint32_t i = 1; i < scheduler->threadCount; i++) {
+        if (scheduler->threads[i].load < target->load) target = &scheduler->threads[i];
+    }
+    auto task = new Task{std::string(source, length), {}, false, nullptr, {}, {}, {memoryLimit, 0, 0}, done, context};
+    target->load++;
+    scheduler->pending++;
+    {
+        std::lock_guard lock(target->lock);
+        target->incoming.push_back(task);
+    }
+    target->wake.notify_one();
+}
+
+void drainScheduler(Scheduler *scheduler) {
+    for (uint64_t pending = scheduler->pending; pending != 0; pending = scheduler->pending) {
+        scheduler->pending.wait(pending);
+    }
+}
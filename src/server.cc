@@ -0,0 +1,385 @@
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <poll.h>
+#include <shared_mutex>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "server.hh"
+#include "chunk.hh"
+#include "compiler.hh"
+#include "memory.hh"
+#include "vm.hh"
+
+static bool readFully(int fd, char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytesRead = read(fd, buffer, size);
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) return false;
+        buffer += bytesRead;
+        size -= bytesRead;
+    }
+    return true;
+}
+
+bool readFrame(int fd, uint8_t *kind, std::string *payload, uint32_t maxLength) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    if (!readFully(fd, (char *) header, sizeof(header))) return false;
+    uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t) header[3] << 24;
+    if (length > maxLength) return false;
+    *kind = header[4];
+    payload->resize(length);
+    return readFully(fd, payload->data(), length);
+}
+
+// The header and payload go out in one writev; MSG_NOSIGNAL is not available for it, so
+// serve() ignores SIGPIPE instead.
+bool writeFrame(int fd, uint8_t kind, const char *payload, uint32_t length) {
+    uint8_t header[FRAME_HEADER_SIZE] = {
+            (uint8_t) length, (uint8_t) (length >> 8), (uint8_t) (length >> 16), (uint8_t) (length >> 24), kind,
+    };
+    iovec parts[2] = {{header, sizeof(header)}, {const_cast<char *>(payload), length}};
+    size_t remaining = sizeof(header) + length;
+    int first = 0;
+    while (remaining > 0) {
+        ssize_t written = writev(fd, parts + first, 2 - first);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        remaining -= written;
+        while (first < 2 && (size_t) written >= parts[first].iov_len) {
+            written -= (ssize_t) parts[first].iov_len;
+            first++;
+        }
+        if (first < 2) {
+            parts[first].iov_base = (char *) parts[first].iov_base + written;
+            parts[first].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// Registered sources are shared by all workers. Compiled chunks are not: their strings are
+// interned in the VM of the worker that compiled them, so every worker compiles its own copy.
+static std::shared_mutex scriptsLock;
+static std::vector<std::string> scripts;
+
+// Idle connections are polled by the accepting thread. One with a request waiting is queued
+// here until a worker is free; the worker answers that one request and hands the connection
+// back through `returnedClients`, so a client that sends nothing holds no worker.
+static std::mutex queueLock;
+static std::condition_variable queueReady;
+static std::deque<int> pendingClients;
+static std::vector<int> activeClients;
+static std::vector<int> returnedClients;
+// Wakes the accepting thread when connections are handed back.
+static int returnEvent = -1;
+static bool stopping = false;
+static size_t requestMemoryLimit = 0;
+
+static volatile sig_atomic_t stopSignal = 0;
+
+static void onStopSignal(int signal) {
+    stopSignal = signal;
+}
+
+struct CachedScript {
+    Chunk chunk;
+    bool compiled;
+};
+
+struct Worker {
+    std::vector<CachedScript> cache;
+    std::string payload;
+    std::string response;
+    // False while the VM is out of memory without its natives; requests then fail.
+    bool started;
+};
+
+static void startVM(Worker *worker) {
+    worker->started = initVM();
+    if (!worker->started) fprintf(stderr, "Out of memory.\n");
+    vm.captureResult = true;
+}
+
+static void dropCache(Worker *worker) {
+    for (CachedScript &script: worker->cache) {
+        if (script.compiled) freeChunk(&script.chunk);
+    }
+    worker->cache.clear();
+}
+
+// Strings made by earlier requests stay interned and the globals they declared keep their
+// slots, so a worker that has grown too large drops everything it holds and starts again.
+static void trimHeap(Worker *worker) {
+    if (worker->started && memoryStats().liveBytes <= SERVE_HEAP_LIMIT &&
+        vm.globalCount <= SERVE_GLOBAL_LIMIT) {
+        return;
+    }
+    dropCache(worker);
+    freeVM();
+    startVM(worker);
+}
+
+static ResponseStatus statusOf(InterpretResult result) {
+    switch (result) {
+        case InterpretResult::OK:
+            return ResponseStatus::OK;
+        case InterpretResult::COMPILE_ERROR:
+            return ResponseStatus::COMPILE_ERROR;
+        case InterpretResult::RUNTIME_ERROR:
+            return ResponseStatus::RUNTIME_ERROR;
+        case InterpretResult::YIELD:
+            break;
+    }
+    return ResponseStatus::BAD_REQUEST;
+}
+
+static void formatResult(Worker *worker) {
+    int length = vm.result.format(nullptr, 0);
+    worker->response.resize(length);
+    // snprintf needs room for the terminator, which std::string keeps past size().
+    vm.result.format(worker->response.data(), length + 1);
+}
+
+// Returns nullptr for an unknown id or a script that fails to compile, setting `status`.
+static Chunk *compiledScript(Worker *worker, uint32_t id, ResponseStatus *status) {
+    if (id < worker->cache.size() && worker->cache[id].compiled) return &worker->cache[id].chunk;
+
+    std::shared_lock lock(scriptsLock);
+    if (id >= scripts.size()) {
+        *status = ResponseStatus::BAD_REQUEST;
+        return nullptr;
+    }
+    if (id >= worker->cache.size()) worker->cache.resize(id + 1);
+    CachedScript *script = &worker->cache[id];
+    initChunk(&script->chunk);
+    if (!compile(scripts[id].data(), scripts[id].size(), &script->chunk)) {
+        freeChunk(&script->chunk);
+        *status = ResponseStatus::COMPILE_ERROR;
+        return nullptr;
+    }
+    script->compiled = true;
+    return &script->chunk;
+}
+
+static ResponseStatus dispatchRequest(Worker *worker, RequestKind kind) {
+    switch (kind) {
+        case RequestKind::EVAL: {
+            InterpretResult result = interpret(worker->payload.data(), worker->payload.size());
+            if (result == InterpretResult::OK) formatResult(worker);
+            return statusOf(result);
+        }
+        case RequestKind::REGISTER: {
+            // Compiling once here reports errors at registration rather than on every RUN.
+            Chunk chunk;
+            initChunk(&chunk);
+            bool compiled = compile(worker->payload.data(), worker->payload.size(), &chunk);
+            freeChunk(&chunk);
+            if (!compiled) return ResponseStatus::COMPILE_ERROR;
+
+            uint32_t id;
+            {
+                std::unique_lock lock(scriptsLock);
+                id = (uint32_t) scripts.size();
+                scripts.push_back(std::move(worker->payload));
+            }
+            uint8_t bytes[4] = {(uint8_t) id, (uint8_t) (id >> 8), (uint8_t) (id >> 16), (uint8_t) (id >> 24)};
+            worker->response.assign((const char *) bytes, sizeof(bytes));
+            return ResponseStatus::OK;
+        }
+        case RequestKind::RUN: {
+            if (worker->payload.size() != 4) return ResponseStatus::BAD_REQUEST;
+            auto bytes = (const uint8_t *) worker->payload.data();
+            uint32_t id = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+            ResponseStatus status = ResponseStatus::OK;
+            Chunk *chunk = compiledScript(worker, id, &status);
+            if (chunk == nullptr) return status;
+            InterpretResult result = interpretChunk(chunk);
+            if (result == InterpretResult::OK) formatResult(worker);
+            return statusOf(result);
+        }
+    }
+    return ResponseStatus::BAD_REQUEST;
+}
+
+// Each request gets a quota of its own, so strings interned by earlier ones are not charged to it.
+static ResponseStatus handleRequest(Worker *worker, RequestKind kind) {
+    worker->response.clear();
+    if (!worker->started) return ResponseStatus::RUNTIME_ERROR;
+    MemoryQuota quota{requestMemoryLimit, 0, 0};
+    setMemoryQuota(&quota);
+    // Requests from different clients meet on the same worker; none sees another's globals.
+    resetGlobals();
+    ResponseStatus status = dispatchRequest(worker, kind);
+    setMemoryQuota(&vm.memory);
+    return status;
+}
+
+// Returns false when the connection is closed or broken and should not be polled again.
+static bool serveRequest(Worker *worker, int fd) {
+    uint8_t kind;
+    if (!readFrame(fd, &kind, &worker->payload, SERVE_MAX_REQUEST)) return false;
+    ResponseStatus status = kind <= (uint8_t) RequestKind::RUN
+                            ? handleRequest(worker, (RequestKind) kind)
+                            : ResponseStatus::BAD_REQUEST;
+    if (!writeFrame(fd, (uint8_t) status, worker->response.data(), (uint32_t) worker->response.size())) return false;
+    trimHeap(worker);
+    return true;
+}
+
+static void runWorker() {
+    Worker worker;
+    startVM(&worker);
+    for (;;) {
+        int fd;
+        {
+            std::unique_lock lock(queueLock);
+            queueReady.wait(lock, [] { return stopping || !pendingClients.empty(); });
+            if (stopping) break;
+            fd = pendingClients.front();
+            pendingClients.pop_front();
+            activeClients.push_back(fd);
+        }
+        bool open = serveRequest(&worker, fd);
+        {
+            std::lock_guard lock(queueLock);
+            std::erase(activeClients, fd);
+            open = open && !stopping;
+            if (open) returnedClients.push_back(fd);
+        }
+        if (open) {
+            uint64_t one = 1;
+            while (write(returnEvent, &one, sizeof(one)) < 0 && errno == EINTR) {}
+        } else {
+            close(fd);
+        }
+    }
+    dropCache(&worker);
+    freeVM();
+}
+
+static int listenOn(const char *socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create a socket: %s.\n", strerror(errno));
+        return -1;
+    }
+    unlink(socketPath);
+    if (bind(fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Could not listen on \"%s\": %s.\n", socketPath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const char *socketPath, uint32_t workers, size_t memoryLimit) {
+    requestMemoryLimit = memoryLimit;
+    int listener = listenOn(socketPath);
+    if (listener < 0) return 74;
+
+    // The stop signals stay blocked everywhere except inside ppoll, so they always land on
+    // this thread and cannot slip in between checking `stopSignal` and waiting.
+    sigset_t stopSignals, waitMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &waitMask);
+    sigdelset(&waitMask, SIGINT);
+    sigdelset(&waitMask, SIGTERM);
+    struct sigaction action{};
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    returnEvent = eventfd(0, EFD_CLOEXEC);
+    if (returnEvent < 0) {
+        fprintf(stderr, "Could not create an event: %s.\n", strerror(errno));
+        close(listener);
+        unlink(socketPath);
+        return 74;
+    }
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < workers; i++) pool.emplace_back(runWorker);
+    fprintf(stderr, "Serving on \"%s\" with %u workers.\n", socketPath, workers);
+
+    // The listener and the event come first, then every idle connection.
+    std::vector<pollfd> polled{{listener, POLLIN, 0}, {returnEvent, POLLIN, 0}};
+    int status = 0;
+    while (stopSignal == 0) {
+        if (ppoll(polled.data(), polled.size(), nullptr, &waitMask) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Could not wait for connections: %s.\n", strerror(errno));
+            status = 74;
+            break;
+        }
+
+        // A connection that has a request, or has closed, goes to a worker, which finds out which.
+        size_t kept = 2;
+        size_t queued = 0;
+        {
+            std::lock_guard lock(queueLock);
+            for (size_t i = 2; i < polled.size(); i++) {
+                if (polled[i].revents != 0) {
+                    pendingClients.push_back(polled[i].fd);
+                    queued++;
+                } else {
+                    polled[kept++] = polled[i];
+                }
+            }
+        }
+        polled.resize(kept);
+        if (queued == 1) queueReady.notify_one(); else if (queued > 1) queueReady.notify_all();
+
+        if (polled[1].revents & POLLIN) {
+            uint64_t count;
+            while (read(returnEvent, &count, sizeof(count)) < 0 && errno == EINTR) {}
+            std::lock_guard lock(queueLock);
+            for (int fd: returnedClients) polled.push_back({fd, POLLIN, 0});
+            returnedClients.clear();
+        }
+        if (polled[0].revents & POLLIN) {
+            int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) polled.push_back({client, POLLIN, 0});
+        }
+    }
+
+    // Shutting the open connections down wakes workers blocked reading them.
+    {
+        std::lock_guard lock(queueLock);
+        stopping = true;
+        for (int fd: pendingClients) close(fd);
+        pendingClients.clear();
+        for (int fd: returnedClients) close(fd);
+        returnedClients.clear();
+        for (int fd: activeClients) shutdown(fd, SHUT_RDWR);
+    }
+    queueReady.notify_all();
+    for (std::thread &worker: pool) worker.join();
+
+    for (size_t i = 2; i < polled.size(); i++) close(polled[i].fd);
+    close(returnEvent);
+    returnEvent = -1;
+    close(listener);
+    unlink(socketPath);
+    return status;
+}
@@ -0,0 +1,330 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "snapshot.hh"
+#include "memory.hh"
+#include "object.hh"
+#include "table.hh"
+#include "vm.hh"
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'C', 'L', 'O', 'X', 'I', 'M', 'G', '1'};
+// Bump whenever the image layout or the encoding or meaning of an instruction changes.
+static constexpr uint32_t SNAPSHOT_VERSION = 3;
+
+// Sections follow the header in this order, each starting on an 8-byte boundary: code, lines,
+// constants, global names, source and strings. Object pointers in constants and global names
+// are offsets from the start of the image.
+struct SnapshotHeader {
+    char magic[8];
+    // An image only loads into a build with the same format, object layout and instruction set.
+    uint32_t version;
+    uint16_t valueSize;
+    uint16_t stringSize;
+    uint16_t opcodeCount;
+    uint16_t reserved;
+    int32_t codeCount;
+    // The whole source is kept, so an image never runs for a script it was not compiled from.
+    uint64_t sourceLength;
+    int32_t constantCount;
+    int32_t globalCount;
+    uint64_t size;
+};
+
+struct SnapshotLayout {
+    uint64_t code;
+    uint64_t lines;
+    uint64_t constants;
+    uint64_t globals;
+    uint64_t source;
+    uint64_t strings;
+};
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static uint64_t stringRecordSize(int length) {
+    return alignSection(sizeof(ObjString) + length + 1);
+}
+
+static SnapshotLayout layoutOf(const SnapshotHeader &header) {
+    SnapshotLayout layout{};
+    layout.code = alignSection(sizeof(SnapshotHeader));
+    layout.lines = alignSection(layout.code + (uint64_t) header.codeCount);
+    layout.constants = alignSection(layout.lines + (uint64_t) header.codeCount * sizeof(int32_t));
+    layout.globals = layout.constants + (uint64_t) header.constantCount * sizeof(Value);
+    layout.source = layout.globals + (uint64_t) header.globalCount * sizeof(uint64_t);
+    layout.strings = alignSection(layout.source + header.sourceLength);
+    return layout;
+}
+
+void initSnapshot(Snapshot *snapshot) {
+    snapshot->mapping = nullptr;
+    snapshot->size = 0;
+}
+
+void freeSnapshot(Snapshot *snapshot) {
+    if (snapshot->mapping != nullptr) munmap(snapshot->mapping, snapshot->size);
+    initSnapshot(snapshot);
+}
+
+// Gives every distinct string its offset in the image, in the order they are first reached.
+static bool placeString(Table *offsets, ObjString *string, uint64_t *end) {
+    Value offset;
+    if (tableGet(offsets, string, &offset)) return true;
+    if (!tableReserve(offsets)) return false;
+    tableSet(offsets, string, Value((int64_t) *end));
+    *end += stringRecordSize(string->length);
+    return true;
+}
+
+static uint64_t offsetOf(Table *offsets, ObjString *string) {
+    Value offset;
+    tableGet(offsets, string, &offset);
+    return (uint64_t) offset.asInteger();
+}
+
+static bool writePadding(FILE *file, uint64_t offset) {
+    static const char zeros[8] = {};
+    uint64_t padding = alignSection(offset) - offset;
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+static bool writeImage(FILE *file, const SnapshotHeader &header, const SnapshotLayout &layout,
+                       const Chunk *chunk, const char *source, Table *offsets, ObjString **strings,
+                       int32_t stringCount) {
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        !writePadding(file, sizeof(header)) ||
+        fwrite(chunk->code, 1, chunk->count, file) != (size_t) chunk->count ||
+        !writePadding(file, layout.code + chunk->count) ||
+        fwrite(chunk->lines, sizeof(int32_t), chunk->count, file) != (size_t) chunk->count ||
+        !writePadding(file, layout.lines + chunk->count * sizeof(int32_t))) {
+        return false;
+    }
+    for (int32_t i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (constant.isObject()) constant.as.obj = (Obj *) offsetOf(offsets, constant.asString());
+        if (fwrite(&constant, sizeof(constant), 1, file) != 1) return false;
+    }
+    for (int32_t i = 0; i < vm.globalCount; i++) {
+        uint64_t offset = offsetOf(offsets, vm.globals[i].name);
+        if (fwrite(&offset, sizeof(offset), 1, file) != 1) return false;
+    }
+    if (fwrite(source, 1, header.sourceLength, file) != header.sourceLength ||
+        !writePadding(file, layout.source + header.sourceLength)) {
+        return false;
+    }
+    for (int32_t i = 0; i < stringCount; i++) {
+        ObjString record = *strings[i];
+        record.obj.sizeClass = SIZE_CLASS_LARGE;
+        record.obj.isMarked = false;
+        if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+            fwrite(strings[i]->chars, 1, strings[i]->length + 1, file) != (size_t) strings[i]->length + 1 ||
+            !writePadding(file, sizeof(ObjString) + strings[i]->length + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writeSnapshot(const char *path, const Chunk *chunk, const char *source, size_t length) {
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.valueSize = sizeof(Value);
+    header.stringSize = sizeof(ObjString);
+    header.opcodeCount = OPCODE_COUNT;
+    header.sourceLength = length;
+    header.codeCount = chunk->count;
+    header.constantCount = chunk->constants.count;
+    header.globalCount = vm.globalCount;
+    SnapshotLayout layout = layoutOf(header);
+
+    // Strings are written in the order they were placed, which the table does not keep.
+    int32_t stringCount = 0;
+    auto strings = ALLOCATE(ObjString *, chunk->constants.count + vm.globalCount, MemoryCategory::OTHER);
+    Table offsets;
+    initTable(&offsets);
+    uint64_t end = layout.strings;
+    bool placed = strings != nullptr || chunk->constants.count + vm.globalCount == 0;
+    for (int32_t i = 0; placed && i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (!constant.isObject()) continue;
+        if (!constant.isString()) {
+            placed = false;
+            break;
+        }
+        int32_t before = offsets.count;
+        placed = placeString(&offsets, constant.asString(), &end);
+        if (offsets.count != before) strings[stringCount++] = constant.asString();
+    }
+    for (int32_t i = 0; placed && i < vm.globalCount; i++) {
+        int32_t before = offsets.count;
+        placed = placeString(&offsets, vm.globals[i].name, &end);
+        if (offsets.count != before) strings[stringCount++] = vm.globals[i].name;
+    }
+    header.size = end;
+
+    bool written = false;
+    if (placed) {
+        char temporary[4096];
+        snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int) getpid());
+        FILE *file = fopen(temporary, "wb");
+        if (file != nullptr) {
+            written = writeImage(file, header, layout, chunk, source, &offsets, strings, stringCount);
+            written = fclose(file) == 0 && written && rename(temporary, path) == 0;
+            if (!written) unlink(temporary);
+        }
+    }
+    freeTable(&offsets);
+    FREE_ARRAY(ObjString *, strings, chunk->constants.count + vm.globalCount, MemoryCategory::OTHER);
+    return written;
+}
+
+// The string at `offset`, interned into this VM, or nullptr when the image is damaged.
+static ObjString *restoreString(const Snapshot *snapshot, const SnapshotLayout &layout, uint64_t offset) {
+    if (offset < layout.strings || offset > snapshot->size - sizeof(ObjString) || offset % 8 != 0) return nullptr;
+    auto string = (ObjString *) ((char *) snapshot->mapping + offset);
+    if (string->obj.type != ObjectType::STRING || string->length < 0 ||
+        (uint64_t) string->length >= snapshot->size - offset - sizeof(ObjString) ||
+        string->chars[string->length] != '\0') {
+        return nullptr;
+    }
+    return adoptString(string);
+}
+
+// Walks the code once so that no operand of a damaged image can index past the constants or
+// globals it came with, or past the end of the code.
+static bool checkCode(const SnapshotHeader &header, const uint8_t *code) {
+    for (int32_t offset = 0; offset < header.codeCount;) {
+        auto instruction = static_cast<OpCode>(code[offset]);
+        int32_t operand = offset + 1;
+        switch (instruction) {
+            case OpCode::RETURN:
+            case OpCode::ADD:
+            case OpCode::SUBTRACT:
+            case OpCode::MULTIPLY:
+            case OpCode::DIVIDE:
+            case OpCode::NEGATE:
+            case OpCode::NIL:
+            case OpCode::TRUE:
+            case OpCode::FALSE:
+            case OpCode::NOT:
+            case OpCode::EQUAL:
+            case OpCode::GREATER:
+            case OpCode::LESS:
+            case OpCode::GREATER_EQUAL:
+            case OpCode::LESS_EQUAL:
+            case OpCode::POP:
+                offset = operand;
+                break;
+            case OpCode::CONSTANT:
+                if (operand >= header.codeCount || code[operand] >= header.constantCount) return false;
+                offset = operand + 1;
+                break;
+            case OpCode::CONSTANT_LONG: {
+                if (operand > header.codeCount - 3) return false;
+                int32_t constant = code[operand] | (code[operand + 1] << 8) | (code[operand + 2] << 16);
+                if (constant >= header.constantCount) return false;
+                offset = operand + 3;
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::GET_LOCAL:
+            case OpCode::SET_LOCAL:
+            case OpCode::POPN:
+                if (operand >= header.codeCount) return false;
+                offset = operand + 1;
+                break;
+            case OpCode::DEFINE_GLOBAL:
+            case OpCode::GET_GLOBAL:
+            case OpCode::SET_GLOBAL:
+                if (operand > header.codeCount - 2 ||
+                    (code[operand] | (code[operand + 1] << 8)) >= header.globalCount) {
+                    return false;
+                }
+                offset = operand + 2;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool restoreChunk(const Snapshot *snapshot, const SnapshotHeader &header, Chunk *chunk) {
+    SnapshotLayout layout = layoutOf(header);
+    auto image = (const char *) snapshot->mapping;
+
+    if (!checkCode(header, (const uint8_t *) image + layout.code)) return false;
+
+    // The code refers to globals by slot, so every name has to land where it was.
+    auto globals = (const uint64_t *) (image + layout.globals);
+    for (int32_t i = 0; i < header.globalCount; i++) {
+        ObjString *name = restoreString(snapshot, layout, globals[i]);
+        if (name == nullptr || globalSlot(name) != i) return false;
+    }
+
+    if (header.codeCount > 0) {
+        chunk->code = ALLOCATE(uint8_t, header.codeCount, MemoryCategory::CODE);
+        if (chunk->code == nullptr) return false;
+        chunk->lines = ALLOCATE(int32_t, header.codeCount, MemoryCategory::LINES);
+        if (chunk->lines == nullptr) {
+            FREE_ARRAY(uint8_t, chunk->code, header.codeCount, MemoryCategory::CODE);
+            chunk->code = nullptr;
+            return false;
+        }
+        chunk->capacity = header.codeCount;
+        chunk->count = header.codeCount;
+        memcpy(chunk->code, image + layout.code, header.codeCount);
+        memcpy(chunk->lines, image + layout.lines, header.codeCount * sizeof(int32_t));
+    }
+
+    auto constants = (const Value *) (image + layout.constants);
+    for (int32_t i = 0; i < header.constantCount; i++) {
+        Value constant = constants[i];
+        if (constant.isObject()) {
+            ObjString *string = restoreString(snapshot, layout, (uint64_t) constant.as.obj);
+            if (string == nullptr) return false;
+            constant = Value(string);
+        }
+        if (!writeValueArray(&chunk->constants, constant)) return false;
+    }
+    return true;
+}
+
+bool loadSnapshot(Snapshot *snapshot, const char *path, const char *source, size_t length, Chunk *chunk) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info{};
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(SnapshotHeader)) {
+        mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    SnapshotHeader header{};
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.valueSize != sizeof(Value) || header.stringSize != sizeof(ObjString) ||
+        header.opcodeCount != OPCODE_COUNT || header.size != (uint64_t) info.st_size ||
+        header.codeCount < 0 || header.constantCount < 0 || header.globalCount < 0 ||
+        header.sourceLength != length || layoutOf(header).strings > header.size ||
+        memcmp((const char *) mapping + layoutOf(header).source, source, length) != 0) {
+        munmap(mapping, info.st_size);
+        return false;
+    }
+
+    // Strings interned before a failure still point into the image, so it stays mapped.
+    snapshot->mapping = mapping;
+    snapshot->size = info.st_size;
+    if (!restoreChunk(snapshot, header, chunk)) {
+        freeChunk(chunk);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#include <cstring>
+#include "table.hh"
+#include "memory.hh"
+#include "object.hh"
+
+void initTable(Table *table) {
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = nullptr;
+}
+
+void freeTable(Table *table) {
+    FREE_ARRAY(Entry, table->entries, table->capacity, MemoryCategory::TABLES);
+    initTable(table);
+}
+
+// Capacities are powers of two, so the probe sequence wraps with a mask.
+static Entry *findEntry(Entry *entries, int32_t capacity, ObjString *key) {
+    uint32_t index = key->hash & (capacity - 1);
+    Entry *tombstone = nullptr;
+    for (;;) {
+        Entry *entry = &entries[index];
+        if (entry->key == nullptr) {
+            if (entry->value.isNil()) return tombstone != nullptr ? tombstone : entry;
+            if (tombstone == nullptr) tombstone = entry;
+        } else if (entry->key == key) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static bool adjustCapacity(Table *table, int32_t capacity) {
+    Entry *entries = ALLOCATE(Entry, capacity, MemoryCategory::TABLES);
+    if (entries == nullptr) return false;
+    for (int32_t i = 0; i < capacity; i++) {
+        entries[i].key = nullptr;
+        entries[i].value = Value();
+    }
+
+    table->count = 0;
+    for (int32_t i = 0; i < table->capacity; i++) {
+        Entry *entry = &table->entries[i];
+        if (entry->key == nullptr) continue;
+        Entry *destination = findEntry(entries, capacity, entry->key);
+        destination->key = entry->key;
+        destination->value = entry->value;
+        table->count++;
+    }
+
+    FREE_ARRAY(Entry, table->entries, table->capacity, MemoryCategory::TABLES);
+    table->entries = entries;
+    table->capacity = capacity;
+    return true;
+}
+
+bool tableReserve(Table *table) {
+    if (table->count + 1 <= table->capacity * TABLE_MAX_LOAD) return true;
+    // Past the load factor probes only get longer; lookups need one empty entry left to stop at.
+    return adjustCapacity(table, GROW_CAPACITY(table->capacity)) || table->count + 1 < table->capacity;
+}
+
+bool tableGet(Table *table, ObjString *key, Value *value) {
+    if (table->count == 0) return false;
+    Entry *entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == nullptr) return false;
+    *value = entry->value;
+    return true;
+}
+
+bool tableSet(Table *table, ObjString *key, Value value) {
+    if (!tableReserve(table)) return false;
+    Entry *entry = findEntry(table->entries, table->capacity, key);
+    bool isNewKey = entry->key == nullptr;
+    // Reusing a tombstone does not change the count; it was never decremented.
+    if (isNewKey && entry->value.isNil()) table->count++;
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+}
+
+bool tableDelete(Table *table, ObjString *key) {
+    if (table->count == 0) return false;
+    Entry *entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == nullptr) return false;
+    entry->key = nullptr;
+    entry->value = Value(true);
+    return true;
+}
+
+ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash) {
+    if (table->count == 0) return nullptr;
+    uint32_t index = hash & (table->capacity - 1);
+    for (;;) {
+        Entry *entry = &table->entries[index];
+        if (entry->key == nullptr) {
+            if (entry->value.isNil()) return nullptr;
+        } else if (entry->key->hash == hash && entry->key->length == length &&
+                   memcmp(entry->key->chars, chars, length) == 0) {
+            return entry->key;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+}
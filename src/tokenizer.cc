@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "tokenizer.hh"
+#include "memory.hh"
+
+uint32_t scanThreads = 0;
+
+// Worker threads allocate through reallocate() too, under a share of the caller's quota; the
+// caller adopts their segments once they are done, so every segment is freed on its thread.
+static constexpr size_t TOKEN_BYTES = sizeof(uint32_t) * 2 + sizeof(int32_t) + sizeof(TokenType);
+
+static void *segmentColumns(const TokenSegment *segment) {
+    return segment->offsets;
+}
+
+static size_t segmentBytes(const TokenSegment *segment) {
+    return TOKEN_BYTES * segment->capacity + sizeof(const char *) * segment->messageCount;
+}
+
+static bool growSegment(TokenSegment *segment) {
+    if (segment->capacity > INT32_MAX / 2) return false;
+    int32_t capacity = segment->capacity < 1024 ? 1024 : segment->capacity * 2;
+    auto columns = ALLOCATE(uint8_t, TOKEN_BYTES * capacity, MemoryCategory::OTHER);
+    if (columns == nullptr) return false;
+
+    auto offsets = (uint32_t *) columns;
+    auto lengths = offsets + capacity;
+    auto lines = (int32_t *) (lengths + capacity);
+    auto types = (TokenType *) (lines + capacity);
+    if (segment->count > 0) {
+        memcpy(offsets, segment->offsets, sizeof(uint32_t) * segment->count);
+        memcpy(lengths, segment->lengths, sizeof(uint32_t) * segment->count);
+        memcpy(lines, segment->lines, sizeof(int32_t) * segment->count);
+        memcpy(types, segment->types, sizeof(TokenType) * segment->count);
+    }
+    FREE_ARRAY(uint8_t, segmentColumns(segment), TOKEN_BYTES * segment->capacity, MemoryCategory::OTHER);
+    segment->offsets = offsets;
+    segment->lengths = lengths;
+    segment->lines = lines;
+    segment->types = types;
+    segment->capacity = capacity;
+    return true;
+}
+
+static bool writeToken(TokenSegment *segment, TokenType type, uint32_t offset, uint32_t length, int32_t line) {
+    if (segment->count == segment->capacity && !growSegment(segment)) return false;
+    segment->types[segment->count] = type;
+    segment->offsets[segment->count] = offset;
+    segment->lengths[segment->count] = length;
+    segment->lines[segment->count] = line;
+    segment->count++;
+    return true;
+}
+
+static bool appendToken(TokenSegment *segment, const char *source, const Token &token) {
+    uint32_t offset = (uint32_t) (lastTokenStart() - source);
+    if (token.type != TokenType::ERROR) return writeToken(segment, token.type, offset, token.length, token.line);
+
+    auto messages = GROW_ARRAY(const char *, segment->messages, segment->messageCount, segment->messageCount + 1,
+                               MemoryCategory::OTHER);
+    if (messages == nullptr) return false;
+    segment->messages = messages;
+    segment->messages[segment->messageCount] = token.start;
+    return writeToken(segment, token.type, offset, segment->messageCount++, token.line);
+}
+
+// Lines count from 1 at `begin`; the chunk's lineBase is filled in once all chunks are done.
+static void scanChunk(const char *source, size_t begin, size_t end, bool keepEnd, TokenSegment *segment) {
+    initScanner(source + begin, end - begin);
+    for (;;) {
+        Token token = scanToken();
+        if (token.type == TokenType::TOKEN_EOF) {
+            segment->newlines = token.line - 1;
+            if (keepEnd && !appendToken(segment, source, token)) segment->outOfMemory = true;
+            return;
+        }
+        if (!appendToken(segment, source, token)) {
+            segment->outOfMemory = true;
+            return;
+        }
+    }
+}
+
+static void scanChunkWithin(MemoryQuota share, const char *source, size_t begin, size_t end, bool keepEnd,
+                            TokenSegment *segment) {
+    setMemoryQuota(&share);
+    scanChunk(source, begin, end, keepEnd, segment);
+    setMemoryQuota(nullptr);
+}
+
+// A chunk ending in an unterminated string may only have cut a string literal short; its
+// error token is the only one that starts at a '"'.
+static bool endsInsideString(const TokenBuffer *buffer, const TokenSegment *segment) {
+    if (segment->count == segment->first) return false;
+    int32_t last = segment->count - 1;
+    return segment->types[last] == TokenType::ERROR && buffer->source[segment->offsets[last]] == '"';
+}
+
+static int32_t findOffset(const TokenSegment *segment, uint32_t offset) {
+    const uint32_t *begin = segment->offsets + segment->first;
+    const uint32_t *end = segment->offsets + segment->count;
+    const uint32_t *found = std::lower_bound(begin, end, offset);
+    return found != end && *found == offset ? (int32_t) (found - segment->offsets) : -1;
+}
+
+// Rescans the whole source from the string the chunk at `chunkIndex` cut short, until a token
+// starts where some later chunk also has one; from there on that chunk's tokens are right.
+// Returns the chunk resynchronized with, or the chunk count if the rescan reached the end or
+// ran out of memory.
+static int32_t repairChunk(TokenBuffer *buffer, size_t length, const size_t *bounds,
+                           int32_t chunkCount, int32_t chunkIndex) {
+    TokenSegment *chunk = &buffer->segments[chunkIndex * 2];
+    TokenSegment *repair = &buffer->segments[chunkIndex * 2 + 1];
+    chunk->count--;
+    uint32_t start = chunk->offsets[chunk->count];
+    // The error token carries the line the string ran out on, the chunk's last.
+    const char *chunkEnd = buffer->source + bounds[chunkIndex + 1];
+    auto stringNewlines = (int32_t) std::count(buffer->source + start, chunkEnd, '\n');
+    repair->lineBase = chunk->lineBase + chunk->lines[chunk->count] - stringNewlines - 1;
+
+    initScanner(buffer->source + start, length - start);
+    int32_t next = chunkIndex + 1;
+    for (;;) {
+        Token token = scanToken();
+        auto offset = (uint32_t) (lastTokenStart() - buffer->source);
+        while (next < chunkCount && offset >= bounds[next + 1]) {
+            TokenSegment *skipped = &buffer->segments[next * 2];
+            skipped->first = skipped->count;
+            next++;
+        }
+        if (next < chunkCount && offset >= bounds[next]) {
+            TokenSegment *resumed = &buffer->segments[next * 2];
+            int32_t index = findOffset(resumed, offset);
+            if (index >= 0) {
+                resumed->first = index;
+                return next;
+            }
+        }
+        if (!appendToken(repair, buffer->source, token)) {
+            repair->outOfMemory = true;
+            return chunkCount;
+        }
+        if (token.type == TokenType::TOKEN_EOF) {
+            for (; next < chunkCount; next++) {
+                TokenSegment *skipped = &buffer->segments[next * 2];
+                skipped->first = skipped->count;
+            }
+            return chunkCount;
+        }
+    }
+}
+
+bool tokenizeParallel(const char *source, size_t length, TokenBuffer *buffer) {
+    *buffer = {};
+    if (length < PARALLEL_SCAN_MIN_BYTES || length > UINT32_MAX) return false;
+    // hardware_concurrency() reads sysfs, so it is only asked once a source is large enough.
+    uint32_t threads = scanThreads != 0 ? scanThreads : std::thread::hardware_concurrency();
+    size_t chunkCount = std::min<size_t>(threads, length / PARALLEL_SCAN_MIN_CHUNK);
+    if (chunkCount < 2) return false;
+
+    // Chunks start right after a newline, so only string literals can cross between them.
+    std::vector<size_t> bounds(chunkCount + 1);
+    bounds[chunkCount] = length;
+    for (size_t i = 1; i < chunkCount; i++) {
+        size_t target = std::max(bounds[i - 1], length / chunkCount * i);
+        const char *newline = (const char *) memchr(source + target, '\n', length - target);
+        bounds[i] = newline == nullptr ? length : newline - source + 1;
+    }
+
+    buffer->source = source;
+    buffer->segments = ALLOCATE(TokenSegment, chunkCount * 2, MemoryCategory::OTHER);
+    if (buffer->segments == nullptr) {
+        buffer->outOfMemory = true;
+        return true;
+    }
+    buffer->segmentCount = (int32_t) chunkCount * 2;
+    for (int32_t i = 0; i < buffer->segmentCount; i++) buffer->segments[i] = {};
+
+    // Each worker may use an even part of what the quota has left.
+    MemoryQuota *quota = memoryQuota();
+    MemoryQuota share{};
+    if (quota != nullptr && quota->limitBytes != 0) {
+        size_t left = quota->limitBytes - std::min(quota->usedBytes, quota->limitBytes);
+        share.limitBytes = std::max<size_t>(left / chunkCount, 1);
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunkCount; i++) {
+        workers.emplace_back(scanChunkWithin, share, source, bounds[i], bounds[i + 1], i + 1 == chunkCount,
+                             &buffer->segments[i * 2]);
+    }
+    scanChunk(source, bounds[0], bounds[1], false, &buffer->segments[0]);
+    for (std::thread &worker: workers) worker.join();
+
+    buffer->outOfMemory = buffer->segments[0].outOfMemory;
+    for (size_t i = 1; i < chunkCount; i++) {
+        const TokenSegment *segment = &buffer->segments[i * 2];
+        if (!adoptAllocation(segmentBytes(segment), MemoryCategory::OTHER) || segment->outOfMemory) {
+            buffer->outOfMemory = true;
+        }
+    }
+    if (buffer->outOfMemory) return true;
+
+    for (size_t i = 1; i < chunkCount; i++) {
+        const TokenSegment *previous = &buffer->segments[(i - 1) * 2];
+        buffer->segments[i * 2].lineBase = previous->lineBase + previous->newlines;
+    }
+    auto chunks = (int32_t) chunkCount;
+    for (int32_t i = 0; i + 1 < chunks;) {
+        if (!endsInsideString(buffer, &buffer->segments[i * 2])) {
+            i++;
+            continue;
+        }
+        int32_t repaired = i;
+        i = repairChunk(buffer, length, bounds.data(), chunks, i);
+        if (buffer->segments[repaired * 2 + 1].outOfMemory) {
+            buffer->outOfMemory = true;
+            return true;
+        }
+    }
+
+    buffer->next = buffer->segments[0].first;
+    return true;
+}
+
+Token nextToken(TokenBuffer *buffer) {
+    if (buffer->outOfMemory) {
+        static const char message[] = "Out of memory.";
+        if (buffer->next++ == 0) return Token{TokenType::ERROR, message, (int32_t) sizeof(message) - 1, 1};
+        return Token{TokenType::TOKEN_EOF, buffer->source, 0, 1};
+    }
+    while (buffer->segment < buffer->segmentCount && buffer->next >= buffer->segments[buffer->segment].count) {
+        if (++buffer->segment < buffer->segmentCount) buffer->next = buffer->segments[buffer->segment].first;
+    }
+    // The last segment holding tokens always ends with TOKEN_EOF, so this is not reached.
+    if (buffer->segment == buffer->segmentCount) return Token{TokenType::TOKEN_EOF, buffer->source, 0, 0};
+
+    const TokenSegment *segment = &buffer->segments[buffer->segment];
+    int32_t index = buffer->next++;
+    Token token{};
+    token.type = segment->types[index];
+    token.start = buffer->source + segment->offsets[index];
+    token.length = (int32_t) segment->lengths[index];
+    token.line = segment->lineBase + segment->lines[index];
+    if (token.type == TokenType::ERROR) {
+        token.start = segment->messages[segment->lengths[index]];
+        token.length = (int32_t) strlen(token.start);
+    }
+    return token;
+}
+
+void freeTokenBuffer(TokenBuffer *buffer) {
+    for (int32_t i = 0; i < buffer->segmentCount; i++) {
+        TokenSegment *segment = &buffer->segments[i];
+        FREE_ARRAY(uint8_t, segmentColumns(segment), TOKEN_BYTES * segment->capacity, MemoryCategory::OTHER);
+        FREE_ARRAY(const char *, segment->messages, segment->messageCount, MemoryCategory::OTHER);
+    }
+    FREE_ARRAY(TokenSegment, buffer->segments, buffer->segmentCount, MemoryCategory::OTHER);
+    *buffer = {};
+}
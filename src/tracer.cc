@@ -0,0 +1,136 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "tracer.hh"
+#include "debug.hh"
+#include "memory.hh"
+#include "value.hh"
+
+static constexpr char TRACE_MAGIC[8] = {'C', 'L', 'O', 'X', 'T', 'R', 'C', '1'};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t total;
+};
+
+TraceRing traceRing;
+
+bool tracerEnabled = false;
+
+static const char *tracePath;
+
+static void dumpOnSignal(int) {
+    int savedErrno = errno;
+    dumpTrace();
+    errno = savedErrno;
+}
+
+bool enableTracer(uint32_t events, const char *path) {
+    uint32_t capacity = 1;
+    while (capacity < events) capacity <<= 1;
+
+    traceRing.events = ALLOCATE(TraceEvent, capacity, MemoryCategory::OTHER);
+    if (traceRing.events == nullptr) return false;
+    traceRing.mask = capacity - 1;
+    traceRing.head.store(0, std::memory_order_relaxed);
+    tracePath = path;
+
+    struct sigaction action{};
+    action.sa_handler = dumpOnSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, nullptr) != 0) return false;
+
+    tracerEnabled = true;
+    return true;
+}
+
+static bool writeAll(int fd, const void *data, size_t size) {
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool dumpTrace() {
+    if (!tracerEnabled) return false;
+
+    uint64_t head = traceRing.head.load(std::memory_order_acquire);
+    uint64_t capacity = (uint64_t) traceRing.mask + 1;
+    uint64_t count = head < capacity ? head : capacity;
+
+    TraceHeader header{};
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.capacity = (uint32_t) capacity;
+    header.count = (uint32_t) count;
+    header.total = head;
+
+    int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    // Oldest event first: the ring may have wrapped, so emit it as two runs.
+    uint64_t first = (head - count) & traceRing.mask;
+    uint64_t tail = capacity - first < count ? capacity - first : count;
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, traceRing.events + first, tail * sizeof(TraceEvent)) &&
+              writeAll(fd, traceRing.events, (count - tail) * sizeof(TraceEvent));
+    close(fd);
+    return ok;
+}
+
+static const char *topName(uint8_t top) {
+    if (top == TRACE_EMPTY_STACK) return "empty";
+    switch (static_cast<ValueType>(top)) {
+        case ValueType::BOOL:
+            return "bool";
+        case ValueType::NIL:
+            return "nil";
+        case ValueType::NUMBER:
+            return "number";
+        case ValueType::OBJECT:
+            return "object";
+        case ValueType::INTEGER:
+            return "integer";
+        default:
+            return "?";
+    }
+}
+
+bool decodeTrace(const char *path, Chunk *chunk) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return false;
+
+    TraceHeader header{};
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    printf("== last %u of %llu instructions ==\n", header.count, (unsigned long long) header.total);
+    TraceEvent event{};
+    for (uint32_t i = 0; i < header.count && fread(&event, sizeof(event), 1, file) == 1; i++) {
+        printf("[%3u %-6s] ", event.depth, topName(event.top));
+        if ((int32_t) event.offset < chunk->count && chunk->code[event.offset] == event.opcode) {
+            disassembleInstruction(chunk, (int32_t) event.offset);
+        } else {
+            // The script changed since the dump was taken; fall back to what the event itself records.
+            const char *name = opcodeName(static_cast<OpCode>(event.opcode));
+            printf("%04u ???? %s\n", event.offset, name != nullptr ? name : "UNKNOWN");
+        }
+    }
+    fclose(file);
+    return true;
+}
@@ -11,18 +11,22 @@ void initValueArray(ValueArray *array) {
     array->count = 0;
 }
 
-void writeValueArray(ValueArray *array, Value value) {
+bool writeValueArray(ValueArray *array, Value value) {
     if (array->capacity < array->count + 1) {
         int32_t oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        int32_t capacity = GROW_CAPACITY(oldCapacity);
+        Value *values = GROW_ARRAY(Value, array->values, oldCapacity, capacity, MemoryCategory::CONSTANTS);
+        if (values == nullptr) return false;
+        array->values = values;
+        array->capacity = capacity;
     }
 
     array->values[array->count] = value;
     array->count++;
+    return true;
 }
 
 void freeValueArray(ValueArray *array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+    FREE_ARRAY(Value, array->values, array->capacity, MemoryCategory::CONSTANTS);
     initValueArray(array);
 }
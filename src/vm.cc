@@ -2,48 +2,220 @@
 // Created by Sergei Lukaushkin on 17.06.2023.
 //
 
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
 #include "vm.hh"
+#include "array.hh"
 #include "value.hh"
-#include "config.hh"
-#include "debug.hh"
 #include "compiler.hh"
 #include "memory.hh"
+#include "profiler.hh"
+#include "tracer.hh"
+#include "perf.hh"
+#include "scanner.hh"
+#include "native.hh"
 
-VM vm;
+thread_local constinit VM vm;
 
 static void resetStack() {
     vm.stackTop = vm.stack;
 }
 
-void initVM() {
+bool initVM() {
     resetStack();
+    vm.memory.usedBytes = 0;
+    vm.memory.peakBytes = 0;
+    setMemoryQuota(&vm.memory);
+    initTable(&vm.strings);
+    initTable(&vm.globalNames);
+    vm.globals = nullptr;
+    vm.globalCount = 0;
+    vm.globalCapacity = 0;
+    vm.writtenGlobals = nullptr;
+    vm.writtenGlobalCount = 0;
+    vm.nativeError = nullptr;
+    return defineStandardNatives();
 }
 
 void freeVM() {
+    flushOutput();
+    setMemoryQuota(nullptr);
+    FREE_ARRAY(Global, vm.globals, vm.globalCapacity, MemoryCategory::OTHER);
+    FREE_ARRAY(int32_t, vm.writtenGlobals, vm.globalCapacity, MemoryCategory::OTHER);
+    vm.globals = nullptr;
+    vm.globalCount = 0;
+    vm.globalCapacity = 0;
+    vm.writtenGlobals = nullptr;
+    vm.writtenGlobalCount = 0;
+    freeTable(&vm.globalNames);
+    freeTable(&vm.strings);
+    freeSlabs();
+}
+
+int32_t globalSlot(ObjString *name) {
+    Value slot;
+    if (tableGet(&vm.globalNames, name, &slot)) return (int32_t) slot.asInteger();
+    if (vm.globalCount == MAX_GLOBALS || !tableReserve(&vm.globalNames)) return -1;
+    if (vm.globalCount == vm.globalCapacity) {
+        int32_t capacity = GROW_CAPACITY(vm.globalCapacity);
+        // Grown along with the slots, so a script writing a global never has to allocate.
+        int32_t *written = GROW_ARRAY(int32_t, vm.writtenGlobals, vm.globalCapacity, capacity,
+                                      MemoryCategory::OTHER);
+        if (written == nullptr) return -1;
+        vm.writtenGlobals = written;
+        Global *globals = GROW_ARRAY(Global, vm.globals, vm.globalCapacity, capacity, MemoryCategory::OTHER);
+        if (globals == nullptr) {
+            vm.writtenGlobals = GROW_ARRAY(int32_t, written, capacity, vm.globalCapacity, MemoryCategory::OTHER);
+            return -1;
+        }
+        vm.globals = globals;
+        vm.globalCapacity = capacity;
+    }
+    int32_t index = vm.globalCount++;
+    vm.globals[index] = {Value(), false, false, false, name, Value()};
+    tableSet(&vm.globalNames, name, Value((int64_t) index));
+    return index;
+}
+
+int32_t defineGlobal(const char *name, Value value) {
+    ObjString *string = copyString(name, (int) strlen(name));
+    int32_t slot = string != nullptr ? globalSlot(string) : -1;
+    if (slot < 0) return -1;
+    vm.globals[slot].hostBound = true;
+    setGlobal(slot, value);
+    return slot;
+}
 
+void setGlobal(int32_t slot, Value value) {
+    Global *global = &vm.globals[slot];
+    global->value = value;
+    global->defined = true;
+    global->bound = value;
+}
+
+static inline void markWritten(int32_t slot) {
+    Global *global = &vm.globals[slot];
+    if (global->written) return;
+    global->written = true;
+    vm.writtenGlobals[vm.writtenGlobalCount++] = slot;
+}
+
+void writeGlobal(int32_t slot, Value value) {
+    Global *global = &vm.globals[slot];
+    global->value = value;
+    global->defined = true;
+    markWritten(slot);
+}
+
+void resetGlobals() {
+    for (int32_t i = 0; i < vm.writtenGlobalCount; i++) {
+        Global *global = &vm.globals[vm.writtenGlobals[i]];
+        global->value = global->bound;
+        global->defined = global->hostBound;
+        global->written = false;
+    }
+    vm.writtenGlobalCount = 0;
 }
 
-InterpretResult interpret(const char *source) {
+// The parser pulls tokens on demand, so scanning is measured as a separate pass over the source.
+static void measureScan(const char *source, size_t length) {
+    beginPerfPhase(PerfPhase::SCAN);
+    initScanner(source, length);
+    while (scanToken().type != TokenType::TOKEN_EOF) {}
+    endPerfPhase(PerfPhase::SCAN);
+}
+
+// Compiles onto the end of `chunk`, bracketed by the profiling phases.
+static bool compileSource(const char *source, size_t length, Chunk *chunk) {
+    if (perfStatsEnabled) {
+        measureScan(source, length);
+        beginPerfPhase(PerfPhase::COMPILE);
+    }
+    setProfilePhase(ProfilePhase::COMPILE);
+    bool compiled = compile(source, length, chunk);
+    setProfilePhase(ProfilePhase::IDLE);
+    if (perfStatsEnabled) endPerfPhase(PerfPhase::COMPILE);
+    return compiled;
+}
+
+static InterpretResult runFrom(Chunk *chunk, int32_t offset) {
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code + offset;
+
+    if (perfStatsEnabled) beginPerfPhase(PerfPhase::EXECUTE);
+    InterpretResult result = run();
+    if (perfStatsEnabled) endPerfPhase(PerfPhase::EXECUTE);
+
+    vm.chunk = nullptr;
+    return result;
+}
+
+InterpretResult interpret(const char *source, size_t length) {
     Chunk chunk;
     initChunk(&chunk);
 
-    if (!compile(source, &chunk)) {
+    if (!compileSource(source, length, &chunk)) {
         freeChunk(&chunk);
         return InterpretResult::COMPILE_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    InterpretResult result = runFrom(&chunk, 0);
 
-    InterpretResult result = run();
+    freeChunk(&chunk);
+    return result;
+}
+
+InterpretResult interpretSnapshot(const char *source, size_t length, const char *path, Snapshot *snapshot) {
+    Chunk chunk;
+    initChunk(&chunk);
+
+    if (!loadSnapshot(snapshot, path, source, length, &chunk)) {
+        if (!compileSource(source, length, &chunk)) {
+            freeChunk(&chunk);
+            return InterpretResult::COMPILE_ERROR;
+        }
+        if (!writeSnapshot(path, &chunk, source, length)) fprintf(stderr, "Could not write snapshot \"%s\".\n", path);
+    }
+
+    InterpretResult result = runFrom(&chunk, 0);
 
     freeChunk(&chunk);
     return result;
 }
 
+InterpretResult interpretChunk(Chunk *chunk) {
+    return runFrom(chunk, 0);
+}
+
+InterpretResult interpretStage(Chunk *chunk, Value input) {
+    *vm.stackTop++ = input;
+    return runFrom(chunk, 0);
+}
+
+void initSession(Session *session) {
+    initChunk(&session->chunk);
+}
+
+void freeSession(Session *session) {
+    freeChunk(&session->chunk);
+}
+
+InterpretResult interpretSession(Session *session, const char *source, size_t length) {
+    Chunk *chunk = &session->chunk;
+    int32_t start = chunk->count;
+    int32_t constants = chunk->constants.count;
+
+    // A failed input leaves nothing behind, so later inputs still run from a clean end.
+    if (!compileSource(source, length, chunk)) {
+        chunk->count = start;
+        chunk->constants.count = constants;
+        return InterpretResult::COMPILE_ERROR;
+    }
+    return runFrom(chunk, start);
+}
+
 static void push(Value value) {
     *vm.stackTop = value;
     vm.stackTop++;
@@ -58,20 +230,26 @@ static Value peek(int32_t distance) {
     return vm.stackTop[-1 - distance];
 }
 
-static void concatenate() {
-    ObjString *b = pop().asString();
-    ObjString *a = pop().asString();
+// Returns false, leaving both operands on the stack, when the result cannot be allocated.
+static bool concatenate() {
+    ObjString *b = peek(0).asString();
+    ObjString *a = peek(1).asString();
 
     int length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    ObjString *result = takeString(chars, length);
+    ObjString *result = allocateString(length);
+    if (result == nullptr) return false;
+    memcpy(result->chars, a->chars, a->length);
+    memcpy(result->chars + a->length, b->chars, b->length);
+    result = internString(result);
+    if (result == nullptr) return false;
+    pop();
+    pop();
     push(Value(result));
+    return true;
 }
 
 static void runtimeError(const char *format, ...) {
+    flushOutput();
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -84,59 +262,238 @@ static void runtimeError(const char *format, ...) {
     resetStack();
 }
 
-InterpretResult run() {
+// One instruction over whole arrays: either operand is an array, and the other an array of the
+// same length or a number. The kernels walk every element, so a slice is charged one
+// instruction per BUDGET_ELEMENTS_PER_INSTRUCTION of them.
+template<bool BUDGETED>
+static bool arrayOp(ArrayOp op) {
+    Value b = peek(0);
+    Value a = peek(1);
+    if ((!a.isArray() && !a.isNumber()) || (!b.isArray() && !b.isNumber())) {
+        runtimeError("Operands must be numbers or arrays.");
+        return false;
+    }
+    if (a.isArray() && b.isArray() && a.asArray()->count != b.asArray()->count) {
+        runtimeError("Arrays must have the same length.");
+        return false;
+    }
+    int32_t count = a.isArray() ? a.asArray()->count : b.asArray()->count;
+    if constexpr (BUDGETED) vm.budget -= std::min(vm.budget, (uint32_t) count / BUDGET_ELEMENTS_PER_INSTRUCTION);
+
+    ObjArray *result = allocateArray(count);
+    if (result == nullptr) {
+        runtimeError("Out of memory.");
+        return false;
+    }
+    double scalarA = a.isNumber() ? a.asNumber() : 0;
+    double scalarB = b.isNumber() ? b.asNumber() : 0;
+    applyArrayOp(op, a.isArray() ? a.asArray()->values : &scalarA, a.isNumber(),
+                 b.isArray() ? b.asArray()->values : &scalarB, b.isNumber(), result->values, count);
+    pop();
+    pop();
+    push(Value(result));
+    return true;
+}
+
+template<bool BUDGETED>
+static bool arrayUnary(ArrayOp op) {
+    ObjArray *array = peek(0).asArray();
+    if constexpr (BUDGETED) vm.budget -= std::min(vm.budget, (uint32_t) array->count / BUDGET_ELEMENTS_PER_INSTRUCTION);
+    ObjArray *result = allocateArray(array->count);
+    if (result == nullptr) {
+        runtimeError("Out of memory.");
+        return false;
+    }
+    applyArrayUnary(op, array->values, result->values, array->count);
+    pop();
+    push(Value(result));
+    return true;
+}
+
+// Calls go straight to the host function: the typed signatures read doubles off the stack and
+// only fall back to converting when an argument is something else.
+static bool callNative(ObjNative *native, int argCount) {
+    if (argCount != native->arity) {
+        runtimeError("Expected %d arguments but got %d.", native->arity, argCount);
+        return false;
+    }
+    Value *args = vm.stackTop - argCount;
+    Value result;
+    switch (native->signature) {
+        case NativeSignature::VALUES:
+            vm.nativeError = nullptr;
+            if (!native->function.values(argCount, args, &result)) {
+                if (vm.nativeError != nullptr) {
+                    runtimeError("%s", vm.nativeError);
+                } else {
+                    runtimeError("Call to '%s' failed.", native->name->chars);
+                }
+                return false;
+            }
+            break;
+        case NativeSignature::NUMBER_0:
+            result = Value(native->function.number0());
+            break;
+        case NativeSignature::NUMBER_1:
+            if (args[0].isDouble()) {
+                result = Value(native->function.number1(args[0].as.number));
+            } else if (args[0].isNumber()) {
+                result = Value(native->function.number1(args[0].asNumber()));
+            } else {
+                runtimeError("Arguments to '%s' must be numbers.", native->name->chars);
+                return false;
+            }
+            break;
+        case NativeSignature::NUMBER_2:
+            if (args[0].isDouble() && args[1].isDouble()) {
+                result = Value(native->function.number2(args[0].as.number, args[1].as.number));
+            } else if (args[0].isNumber() && args[1].isNumber()) {
+                result = Value(native->function.number2(args[0].asNumber(), args[1].asNumber()));
+            } else {
+                runtimeError("Arguments to '%s' must be numbers.", native->name->chars);
+                return false;
+            }
+            break;
+    }
+    vm.stackTop -= argCount + 1;
+    push(result);
+    return true;
+}
+
+// Orders an integer against a double that is not NaN: negative, zero or positive as the
+// integer is less, equal or greater. Exact, where converting either side could round.
+static int32_t compareExact(int64_t integer, double number) {
+    if (number >= 0x1p63) return -1;
+    if (number < -0x1p63) return 1;
+    auto whole = (int64_t) number;
+    if (integer != whole) return integer < whole ? -1 : 1;
+    // Truncation went toward zero, so what is left over decides.
+    double fraction = number - (double) whole;
+    return fraction > 0 ? -1 : fraction < 0 ? 1 : 0;
+}
+
+// INSTRUMENTED instantiates a second copy of the loop so the plain one pays nothing for profiling;
+// BUDGETED likewise keeps the instruction countdown out of the loops that run to completion.
+template<bool INSTRUMENTED, bool BUDGETED>
+static InterpretResult execute() {
 #define READ_BYTE() (*vm.ip++)
 #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(op)                          \
-    do {                                                  \
-        if (!peek(0).isNumber() || !peek(1).isNumber()) { \
-            runtimeError("Operands must be numbers.");    \
-            return InterpretResult::RUNTIME_ERROR;        \
-        }                                                 \
-        double b = pop().asNumber();                      \
-        double a = pop().asNumber();                      \
-        push(Value(a op b));                          \
+#define READ_SHORT() (vm.ip += 2, (uint16_t) (vm.ip[-2] | (vm.ip[-1] << 8)))
+#define READ_CONSTANT_LONG() \
+    (vm.ip += 3, vm.chunk->constants.values[vm.ip[-3] | (vm.ip[-2] << 8) | (vm.ip[-1] << 16)])
+// With an array on either side the whole array is done at once, by `arrayOperation`.
+#define BINARY_OP(op, arrayOperation)                                               \
+    do {                                                                            \
+        if (!peek(0).isNumber() || !peek(1).isNumber()) {                           \
+            if (!peek(0).isArray() && !peek(1).isArray()) {                         \
+                runtimeError("Operands must be numbers.");                          \
+                return InterpretResult::RUNTIME_ERROR;                              \
+            }                                                                       \
+            if (!arrayOp<BUDGETED>(arrayOperation)) return InterpretResult::RUNTIME_ERROR; \
+        } else {                                                                    \
+            double b = pop().asNumber();                                            \
+            double a = pop().asNumber();                                            \
+            push(Value(a op b));                                                    \
+        }                                                                           \
+    } while (0)
+// Integers stay integers unless `checked`, a __builtin_*_overflow, reports that the result
+// does not fit; then it is redone in doubles.
+#define INTEGER_OP(op, checked, arrayOperation)                                          \
+    do {                                                                                 \
+        if (peek(0).isInteger() && peek(1).isInteger()) {                                \
+            int64_t b = pop().asInteger();                                               \
+            int64_t a = pop().asInteger();                                               \
+            int64_t result;                                                              \
+            push(checked(a, b, &result) ? Value((double) a op (double) b) : Value(result)); \
+        } else {                                                                         \
+            BINARY_OP(op, arrayOperation);                                               \
+        }                                                                                \
+    } while (0)
+// An integer and a double are compared exactly rather than with the integer rounded.
+#define COMPARISON_OP(op, arrayOperation)                            \
+    do {                                                             \
+        if (peek(0).isInteger() && peek(1).isInteger()) {            \
+            int64_t b = pop().asInteger();                           \
+            int64_t a = pop().asInteger();                           \
+            push(Value(a op b));                                     \
+        } else if (peek(1).isInteger() && peek(0).isDouble()) {      \
+            double b = pop().asNumber();                             \
+            int64_t a = pop().asInteger();                           \
+            push(Value(b == b && compareExact(a, b) op 0));          \
+        } else if (peek(1).isDouble() && peek(0).isInteger()) {      \
+            int64_t b = pop().asInteger();                           \
+            double a = pop().asNumber();                             \
+            push(Value(a == a && 0 op compareExact(b, a)));          \
+        } else {                                                     \
+            BINARY_OP(op, arrayOperation);                           \
+        }                                                            \
     } while (0)
 
     for (;;) {
-#if defined(DEBUG_TRACE_EXECUTION)
-        printf("         ");
-        for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-            printf("[ ");
-            (*slot).print();
-            printf(" ]");
+        if constexpr (BUDGETED) {
+            if (vm.budget == 0) return InterpretResult::YIELD;
+            vm.budget--;
         }
-        printf("\n");
-        disassembleInstruction(vm.chunk, (int32_t) (vm.ip - vm.chunk->code));
-#endif
-        OpCode instruction;
-        switch (instruction = static_cast<OpCode>(READ_BYTE())) {
+        auto instruction = static_cast<OpCode>(READ_BYTE());
+        if constexpr (INSTRUMENTED) {
+            if (opProfilerEnabled) profileOp(instruction);
+            if (lineProfilerEnabled) lineProfile.ip = vm.ip;
+            if (tracerEnabled) {
+                auto depth = (uint16_t) (vm.stackTop - vm.stack);
+                traceInstruction((uint32_t) (vm.ip - vm.chunk->code - 1), static_cast<uint8_t>(instruction),
+                                 depth == 0 ? TRACE_EMPTY_STACK : static_cast<uint8_t>(vm.stackTop[-1].type),
+                                 depth);
+            }
+        }
+        switch (instruction) {
             case OpCode::RETURN:
-                pop().print();
-                printf("\n");
+                if (vm.captureResult) {
+                    vm.result = pop();
+                } else {
+                    pop().print();
+                    writeOutput("\n", 1);
+                }
                 return InterpretResult::OK;
             case OpCode::ADD:
-                if (peek(0).isString() && peek(1).isString()) {
-                    concatenate();
-                } else if (peek(0).isNumber() && peek(1).isNumber()) {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
-                    push(Value(a + b));
+                if (peek(0).isNumber() && peek(1).isNumber()) {
+                    INTEGER_OP(+, __builtin_add_overflow, ArrayOp::ADD);
+                } else if (peek(0).isString() && peek(1).isString()) {
+                    // Copying and hashing take time in proportion to the length, so a slice is
+                    // charged one instruction per BUDGET_BYTES_PER_INSTRUCTION of result.
+                    if constexpr (BUDGETED) {
+                        uint32_t cost = (peek(0).asString()->length + peek(1).asString()->length) /
+                                        BUDGET_BYTES_PER_INSTRUCTION;
+                        vm.budget -= std::min(vm.budget, cost);
+                    }
+                    if (!concatenate()) {
+                        runtimeError("Out of memory.");
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                } else if (peek(0).isArray() || peek(1).isArray()) {
+                    if (!arrayOp<BUDGETED>(ArrayOp::ADD)) return InterpretResult::RUNTIME_ERROR;
                 } else {
                     runtimeError("Operands must be two numbers or two strings.");
                     return InterpretResult::RUNTIME_ERROR;
                 }
                 break;
             case OpCode::SUBTRACT:
-                BINARY_OP(-);
+                INTEGER_OP(-, __builtin_sub_overflow, ArrayOp::SUBTRACT);
                 break;
             case OpCode::MULTIPLY:
-                BINARY_OP(*);
+                INTEGER_OP(*, __builtin_mul_overflow, ArrayOp::MULTIPLY);
                 break;
             case OpCode::DIVIDE:
-                BINARY_OP(/);
+                BINARY_OP(/, ArrayOp::DIVIDE);
                 break;
             case OpCode::NEGATE:
+                if (peek(0).isInteger() && peek(0).asInteger() != INT64_MIN) {
+                    push(Value(-pop().asInteger()));
+                    break;
+                }
+                if (peek(0).isArray()) {
+                    if (!arrayUnary<BUDGETED>(ArrayOp::NEGATE)) return InterpretResult::RUNTIME_ERROR;
+                    break;
+                }
                 if (!peek(0).isNumber()) {
                     runtimeError("Operand must be a number.");
                     return InterpretResult::RUNTIME_ERROR;
@@ -148,6 +505,9 @@ InterpretResult run() {
                 push(constant);
                 break;
             }
+            case OpCode::CONSTANT_LONG:
+                push(READ_CONSTANT_LONG());
+                break;
             case OpCode::NIL:
                 push(Value());
                 break;
@@ -167,15 +527,91 @@ InterpretResult run() {
                 break;
             }
             case OpCode::GREATER:
-                BINARY_OP(>);
+                COMPARISON_OP(>, ArrayOp::GREATER);
                 break;
             case OpCode::LESS:
-                BINARY_OP(<);
+                COMPARISON_OP(<, ArrayOp::LESS);
+                break;
+            case OpCode::GREATER_EQUAL:
+                COMPARISON_OP(>=, ArrayOp::GREATER_EQUAL);
+                break;
+            case OpCode::LESS_EQUAL:
+                COMPARISON_OP(<=, ArrayOp::LESS_EQUAL);
+                break;
+            case OpCode::CALL: {
+                uint8_t argCount = READ_BYTE();
+                Value callee = peek(argCount);
+                if (!callee.isNative()) {
+                    runtimeError("Can only call functions.");
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                if (!callNative(callee.asNative(), argCount)) return InterpretResult::RUNTIME_ERROR;
+                break;
+            }
+            case OpCode::POP:
+                pop();
+                break;
+            case OpCode::DEFINE_GLOBAL:
+                writeGlobal(READ_SHORT(), pop());
+                break;
+            case OpCode::GET_GLOBAL: {
+                Global *global = &vm.globals[READ_SHORT()];
+                if (!global->defined) {
+                    runtimeError("Undefined variable '%s'.", global->name->chars);
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                push(global->value);
+                break;
+            }
+            case OpCode::SET_GLOBAL: {
+                uint16_t slot = READ_SHORT();
+                Global *global = &vm.globals[slot];
+                if (!global->defined) {
+                    runtimeError("Undefined variable '%s'.", global->name->chars);
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                global->value = peek(0);
+                markWritten(slot);
+                break;
+            }
+            case OpCode::GET_LOCAL:
+                push(vm.stack[READ_BYTE()]);
+                break;
+            case OpCode::SET_LOCAL:
+                vm.stack[READ_BYTE()] = peek(0);
+                break;
+            case OpCode::POPN:
+                vm.stackTop -= READ_BYTE();
                 break;
         }
     }
 #undef READ_BYTE
 #undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef READ_SHORT
 #undef BINARY_OP
+#undef INTEGER_OP
+#undef COMPARISON_OP
 }
 
+InterpretResult run() {
+    if (!opProfilerEnabled && !lineProfilerEnabled && !tracerEnabled) return execute<false, false>();
+
+    lineProfile.ip = nullptr;
+    lineProfile.chunk = vm.chunk;
+    setProfilePhase(ProfilePhase::EXECUTE);
+    InterpretResult result = execute<true, false>();
+    setProfilePhase(ProfilePhase::IDLE);
+    lineProfile.chunk = nullptr;
+    endOpProfile();
+    if (result == InterpretResult::RUNTIME_ERROR && tracerEnabled && !dumpTrace()) {
+        fprintf(stderr, "Could not write the execution trace.\n");
+    }
+    return result;
+}
+
+
+InterpretResult runBudgeted(uint32_t budget) {
+    vm.budget = budget;
+    return execute<false, true>();
+}
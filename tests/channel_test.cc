@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "channel.hh"
+#include "object.hh"
+#include "vm.hh"
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+#define MESSAGES_PER_PRODUCER 20000
+
+// Every receiver sees the end once the last producer closes, however the end marker is passed
+// between them, and every number sent arrives exactly once. A tiny capacity keeps both sides
+// blocking and the positions wrapping.
+static void testHandoff(uint32_t capacity, int producers, int receivers) {
+    Channel channel;
+    initChannel(&channel, capacity, producers);
+    std::vector<std::vector<int64_t>> received(receivers);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < receivers; r++) {
+        threads.emplace_back([&, r] {
+            Value value;
+            ReceiveResult result;
+            while ((result = receiveMessage(&channel, &value)) == ReceiveResult::OK) {
+                CHECK(value.isInteger());
+                received[r].push_back(value.asInteger());
+            }
+            CHECK(result == ReceiveResult::CLOSED);
+            // The end stays for anyone who asks again.
+            CHECK(receiveMessage(&channel, &value) == ReceiveResult::CLOSED);
+        });
+    }
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (int64_t i = 0; i < MESSAGES_PER_PRODUCER; i++) {
+                sendMessage(&channel, Value(p * MESSAGES_PER_PRODUCER + i));
+            }
+            closeChannel(&channel);
+        });
+    }
+    for (std::thread &thread: threads) thread.join();
+
+    std::vector<int> seen(producers * MESSAGES_PER_PRODUCER);
+    for (const std::vector<int64_t> &values: received) {
+        for (int64_t value: values) seen[value]++;
+    }
+    for (int count: seen) CHECK(count == 1);
+    CHECK(channel.producers == 0);
+    freeChannel(&channel);
+}
+
+// A received string is the receiver's own copy, so it outlives the heap it was sent from once
+// drainChannel() has returned.
+static void testStringsOutliveSender() {
+    Channel channel;
+    initChannel(&channel, 4, 1);
+    CHECK(initVM());
+    std::thread sender([&] {
+        CHECK(initVM());
+        for (int i = 0; i < 100; i++) {
+            std::string text = "message " + std::to_string(i);
+            sendMessage(&channel, Value(copyString(text.data(), (int) text.size())));
+        }
+        closeChannel(&channel);
+        drainChannel(&channel);
+        freeVM();
+    });
+    std::vector<ObjString *> strings;
+    Value value;
+    while (receiveMessage(&channel, &value) == ReceiveResult::OK) {
+        CHECK(value.isString());
+        strings.push_back(value.asString());
+    }
+    sender.join();
+
+    CHECK(strings.size() == 100);
+    for (int i = 0; i < 100; i++) {
+        std::string text = "message " + std::to_string(i);
+        CHECK(strings[i]->length == (int) text.size() && memcmp(strings[i]->chars, text.data(), text.size()) == 0);
+        // Interned here, so an equal string made on this thread is the same object.
+        CHECK(copyString(text.data(), (int) text.size()) == strings[i]);
+    }
+    freeVM();
+    freeChannel(&channel);
+}
+
+int main() {
+    testHandoff(2, 1, 1);
+    testHandoff(2, 4, 4);
+    testHandoff(64, 3, 8);
+    testHandoff(1024, 8, 2);
+    testStringsOutliveSender();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+#include "map.hh"
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+// Every key the reference holds is found with its value, and the counts agree.
+static void checkSame(const Map *map, const std::map<int64_t, int64_t> &reference) {
+    CHECK(map->count == (int32_t) reference.size());
+    for (const auto &[key, expected]: reference) {
+        Value value;
+        CHECK(mapGet(map, Value(key), &value));
+        CHECK(value.isInteger() && value.asInteger() == expected);
+    }
+}
+
+// Random inserts, overwrites and deletes over a key range small enough to hit the same keys
+// again, growing the map through several resizes and shrinking it back down.
+static void testChurn() {
+    Map map;
+    initMap(&map);
+    std::map<int64_t, int64_t> reference;
+    std::mt19937_64 random(42);
+    for (int round = 0; round < 4; round++) {
+        int64_t range = (int64_t) 64 << (round * 3);
+        for (int i = 0; i < 200000; i++) {
+            int64_t key = (int64_t) (random() % range);
+            if (random() % 3 != 0) {
+                CHECK(mapSet(&map, Value(key), Value((int64_t) i)));
+                reference[key] = i;
+            } else {
+                CHECK(mapDelete(&map, Value(key)) == (reference.erase(key) == 1));
+            }
+            Value value;
+            CHECK(mapGet(&map, Value(key), &value) == reference.contains(key));
+        }
+        checkSame(&map, reference);
+    }
+    for (auto it = reference.begin(); it != reference.end(); it = reference.erase(it)) {
+        CHECK(mapDelete(&map, Value(it->first)));
+    }
+    CHECK(map.count == 0);
+    freeMap(&map);
+}
+
+// Keys whose home is the last slot run on past the end of the table into slot 0; deleting
+// from such a run has to move entries back across the wraparound.
+static void testWraparound() {
+    Map map;
+    initMap(&map);
+    // One key gives the table its smallest capacity; the ten below stay under its load limit.
+    CHECK(mapSet(&map, Value((int64_t) 0), Value()));
+    CHECK(mapDelete(&map, Value((int64_t) 0)));
+    int32_t capacity = map.capacity;
+    std::map<int64_t, int64_t> reference;
+
+    // Same mixing as the map's integer hash; the high bits past the control byte pick the home.
+    auto homeOf = [&](int64_t key) {
+        auto hash = (uint32_t) (((uint64_t) key * 0x9E3779B97F4A7C15u) >> 32);
+        return (hash >> 7) & (uint32_t) (capacity - 1);
+    };
+    std::vector<int64_t> atEnd;
+    std::vector<int64_t> atStart;
+    for (int64_t key = 1; atEnd.size() < 6 || atStart.size() < 4; key++) {
+        if (homeOf(key) == (uint32_t) capacity - 1 && atEnd.size() < 6) atEnd.push_back(key);
+        if (homeOf(key) == 0 && atStart.size() < 4) atStart.push_back(key);
+    }
+    for (int64_t key: atEnd) {
+        CHECK(mapSet(&map, Value(key), Value(key * 10)));
+        reference[key] = key * 10;
+    }
+    for (int64_t key: atStart) {
+        CHECK(mapSet(&map, Value(key), Value(key * 10)));
+        reference[key] = key * 10;
+    }
+    CHECK(map.capacity == capacity);
+    checkSame(&map, reference);
+
+    // Take the run apart from the front, the middle and the wrapped part.
+    for (int64_t key: {atEnd[0], atStart[1], atEnd[3], atEnd[5], atStart[0]}) {
+        CHECK(mapDelete(&map, Value(key)));
+        reference.erase(key);
+        checkSame(&map, reference);
+        Value value;
+        CHECK(!mapGet(&map, Value(key), &value));
+    }
+    for (int64_t key: atEnd) {
+        CHECK(mapSet(&map, Value(key), Value(key)));
+        reference[key] = key;
+    }
+    checkSame(&map, reference);
+    freeMap(&map);
+}
+
+// 1 and 1.0 are one key.
+static void testNumberKeys() {
+    Map map;
+    initMap(&map);
+    CHECK(mapSet(&map, Value((int64_t) 1), Value((int64_t) 1)));
+    CHECK(mapSet(&map, Value(1.0), Value((int64_t) 2)));
+    CHECK(map.count == 1);
+    Value value;
+    CHECK(mapGet(&map, Value((int64_t) 1), &value) && value.asInteger() == 2);
+    CHECK(mapSet(&map, Value(1.5), Value((int64_t) 3)));
+    CHECK(mapDelete(&map, Value(1.0)));
+    CHECK(!mapGet(&map, Value((int64_t) 1), &value));
+    CHECK(mapGet(&map, Value(1.5), &value) && value.asInteger() == 3);
+    freeMap(&map);
+}
+
+int main() {
+    testChurn();
+    testWraparound();
+    testNumberKeys();
+    return 0;
+}
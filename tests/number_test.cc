@@ -0,0 +1,104 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "number.hh"
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+static bool sameBits(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static int format(double value, char *buffer) {
+    int length = formatDouble(value, buffer);
+    CHECK(length > 0 && length < DOUBLE_BUFFER_SIZE);
+    buffer[length] = '\0';
+    return length;
+}
+
+// Digits of the mantissa without leading or trailing zeros, as written by formatDouble().
+static int significantDigits(const char *text) {
+    const char *end = strchr(text, 'e');
+    if (end == nullptr) end = text + strlen(text);
+    const char *first = text;
+    while (first < end && (*first == '-' || *first == '0' || *first == '.')) first++;
+    const char *last = end;
+    while (last > first && (last[-1] == '0' || last[-1] == '.')) last--;
+    int digits = 0;
+    for (const char *c = first; c < last; c++) digits += *c != '.';
+    return digits;
+}
+
+// The fewest significant digits that read back as `value`, found the slow way.
+static int shortestDigits(double value) {
+    char buffer[64];
+    for (int precision = 1; precision < 17; precision++) {
+        snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+        if (strtod(buffer, nullptr) == value) return precision;
+    }
+    return 17;
+}
+
+// Formatting any finite double reads back to the same bits, with no more digits than needed;
+// positional output also reads back through the scanner's own parser.
+static void checkRoundTrip(double value) {
+    char buffer[DOUBLE_BUFFER_SIZE];
+    int length = format(value, buffer);
+    CHECK(sameBits(strtod(buffer, nullptr), value));
+    if (value != 0) CHECK(significantDigits(buffer) == shortestDigits(value));
+    if (value > 0 && strchr(buffer, 'e') == nullptr) CHECK(sameBits(parseDecimal(buffer, buffer + length), value));
+}
+
+static void testFormatRoundTrip() {
+    std::mt19937_64 random(7);
+    std::uniform_real_distribution<double> positional(-6, 21);
+    for (int i = 0; i < 50000; i++) {
+        uint64_t bits = random();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (std::isfinite(value)) checkRoundTrip(value);
+        checkRoundTrip(std::pow(10.0, positional(random)));
+        checkRoundTrip((double) (random() >> (random() % 64)));
+    }
+    for (double value: {0.0, -0.0, 0.1, 0.3, 1e-6, 1e-7, 1e20, 1e21, 5e-324, 2.2250738585072014e-308,
+                        1.7976931348623157e308, 9007199254740993.0, 123456789012345678901.0}) {
+        checkRoundTrip(value);
+    }
+}
+
+// Literals the scanner accepts convert to the nearest double, however many digits they have.
+static void testParse() {
+    std::mt19937_64 random(11);
+    char buffer[96];
+    for (int i = 0; i < 100000; i++) {
+        int whole = 1 + (int) (random() % 30);
+        int fraction = (int) (random() % 40);
+        int length = 0;
+        for (int d = 0; d < whole; d++) buffer[length++] = (char) ('0' + random() % 10);
+        if (fraction > 0) {
+            buffer[length++] = '.';
+            for (int d = 0; d < fraction; d++) buffer[length++] = (char) ('0' + random() % 10);
+        }
+        buffer[length] = '\0';
+        CHECK(sameBits(parseDecimal(buffer, buffer + length), strtod(buffer, nullptr)));
+    }
+    // Halfway between two doubles, decided by a digit far past the seventeenth.
+    for (const char *literal: {"9007199254740993", "9007199254740993.0000000000000000001",
+                               "0.1000000000000000055511151231257827", "2.4703282292062327208828439643411"}) {
+        CHECK(sameBits(parseDecimal(literal, literal + strlen(literal)), strtod(literal, nullptr)));
+    }
+}
+
+int main() {
+    testFormatRoundTrip();
+    testParse();
+    return 0;
+}